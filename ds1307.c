@@ -8,9 +8,11 @@
 #include <linux/spi/spidev.h>
 #include <linux/i2c-dev.h>
 #include <time.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <errno.h>
 
+#include "edgpio.h"
 #include "i2c.h"
 
 // DS1807 Definitions
@@ -36,9 +38,39 @@
 
 #define CENTURY    2000
 
+#define NSEC       1000000000LL
+
+// Time between RTC reads while waiting for the seconds to roll over
+#define SYNC_POLL  10000000
+
+// Days from 0000-03-01 to 1970-01-01 in the proleptic Gregorian calendar
+#define EPOCH_DAYS 719468
+
 // RTC Variables
 uint8_t rtcConfig = 0x03;
 
+// Cached time.  rtcAnchor is the RTC time in ns since the epoch at
+// rtcAnchorMono on CLOCK_MONOTONIC, it is re-read every rtcResync seconds.
+static int rtcResync = 0;
+static int rtcAnchorValid = 0;
+static int64_t rtcAnchor;
+static int64_t rtcAnchorMono;
+static int64_t rtcDrift = 0;
+
+// Host copy of the battery backed RAM, indexed by RTC address so only
+// RTCMEMSTART to RTCMEMSIZE - 1 are used.  Bit n of rtcNvramDirty is set
+// when address n has been written but not flushed.
+static uint8_t rtcNvram[RTCMEMSIZE];
+static uint64_t rtcNvramDirty = 0;
+static int rtcNvramLoaded = 0;
+static int rtcNvramCrc = 0;
+static int rtcNvramInterval = 0;
+static int64_t rtcNvramDeadline = 0;
+static int rtcNvramTimer = -1;
+
+// With CRC on the last two bytes of RAM hold a CRC-16 of the rest
+#define NVRAM_CRC  (RTCMEMSIZE - 2)
+
 static unsigned char bcdToDec(unsigned char bcd)
 {
     return (unsigned char)((HI_NIBBLE(bcd) * 10) + (LO_NIBBLE(bcd)));
@@ -49,64 +81,330 @@ static unsigned char decToBcd(char dec)
     return (unsigned char)((dec / 10) * 16) + (dec % 10);
 }
 
-void rtcSetDate(struct tm *date)
+int rtcSetDate(struct tm *date)
 {
     /**
     * Set the date on the RTC
     * @param date - struct tm formated date and time
+    * @returns - 0, or a negative errno on bus error
+    */
+    uint8_t wrBuffer[8];
+
+    wrBuffer[0] = SECONDS; // register address for seconds
+    wrBuffer[1] = decToBcd(date -> tm_sec);
+    wrBuffer[2] = decToBcd(date -> tm_min);
+    wrBuffer[3] = decToBcd(date -> tm_hour);
+    wrBuffer[4] = decToBcd(date -> tm_wday);
+    wrBuffer[5] = decToBcd(date -> tm_mday);
+    wrBuffer[6] = decToBcd(date -> tm_mon + 1);
+    wrBuffer[7] = decToBcd(date -> tm_year % 100);
+
+    rtcAnchorValid = 0;
+
+    return i2cWriteByteArray(I2C_DEFAULT_BUS, RTCADDRESS, wrBuffer, 8);
+}
+
+static int rtc_read(struct tm *date)
+{
+    uint8_t rdBuffer[7];
+    int status;
+
+    status = i2cReadByteArray(I2C_DEFAULT_BUS, RTCADDRESS, 0, rdBuffer, 7);
+    if(status < 0)
+    {
+        return status;
+    }
+
+    date -> tm_sec = bcdToDec(rdBuffer[0]);
+    date -> tm_min = bcdToDec(rdBuffer[1]);
+    date -> tm_hour = bcdToDec(rdBuffer[2]);
+    date -> tm_wday = bcdToDec(rdBuffer[3]);
+    date -> tm_mday = bcdToDec(rdBuffer[4]);
+    date -> tm_mon = bcdToDec(rdBuffer[5]) - 1;
+    date -> tm_year = bcdToDec(rdBuffer[6]) + (CENTURY - 1900);
+
+    return 0;
+}
+
+static int64_t monotonic_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * NSEC + now.tv_nsec;
+}
+
+// Read the RTC and fit the anchor to it.  The RTC only counts whole seconds
+// so a reading of S means the time is somewhere in [S, S + 1).  The first
+// sync waits for the seconds to roll over, reading every SYNC_POLL ns, and
+// anchors on the middle of the last two reads so it is within SYNC_POLL / 2
+// of the boundary.  Later syncs only move the anchor if the extrapolated
+// time has left that window, and the amount moved is the drift.  On a bus
+// error the anchor is left as it was.
+static int rtc_sync()
+{
+    struct timespec poll = { 0, SYNC_POLL };
+    struct tm date;
+    int64_t rtc;
+    int64_t mono;
+    int64_t before;
+    int64_t predicted;
+    int64_t limit;
+    uint8_t seconds;
+    int status;
+
+    status = rtc_read(&date);
+    if(status < 0)
+    {
+        return status;
+    }
+    mono = monotonic_ns();
+
+    if(rtcAnchorValid == 0)
+    {
+        seconds = date.tm_sec;
+        limit = mono + 11 * NSEC / 10;
+        before = mono;
+        while(date.tm_sec == seconds && mono < limit)
+        {
+            before = mono;
+            nanosleep(&poll, NULL);
+            status = rtc_read(&date);
+            if(status < 0)
+            {
+                return status;
+            }
+            mono = monotonic_ns();
+        }
+
+        rtcAnchor = rtcEpoch(&date) * NSEC;
+        rtcAnchorMono = before + (mono - before) / 2;
+        rtcAnchorValid = 1;
+        rtcDrift = 0;
+        return 0;
+    }
+
+    rtc = rtcEpoch(&date) * NSEC;
+    predicted = rtcAnchor + (mono - rtcAnchorMono);
+
+    rtcDrift = 0;
+    if(predicted < rtc)
+    {
+        rtcDrift = rtc - predicted;
+    }
+    if(predicted >= rtc + NSEC)
+    {
+        rtcDrift = rtc + NSEC - 1 - predicted;
+    }
+
+    rtcAnchor = predicted + rtcDrift;
+    rtcAnchorMono = mono;
+
+    return 0;
+}
+
+time_t rtcEpoch(struct tm *date)
+{
+    /**
+    * Convert a date to seconds since 1970-01-01 00:00:00 without mktime()
+    * The date is taken as is, no time zone or daylight saving is applied
+    * @param date - tm_year, tm_mon, tm_mday, tm_hour, tm_min and tm_sec are used
+    * @returns - seconds since the epoch
+    */
+
+    int64_t year;
+    int64_t month;
+    int64_t era;
+    int64_t yoe;
+    int64_t doy;
+    int64_t days;
+
+    year = date -> tm_year + 1900;
+    month = date -> tm_mon + 1;
+    if(month <= 2)
+    {
+        year--;
+    }
+
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + date -> tm_mday - 1;
+    days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - EPOCH_DAYS;
+
+    return days * 86400 + date -> tm_hour * 3600 + date -> tm_min * 60 + date -> tm_sec;
+}
+
+static void rtc_break_down(time_t secs, struct tm *date)
+{
+    int64_t days;
+    int64_t rem;
+    int64_t era;
+    int64_t doe;
+    int64_t yoe;
+    int64_t doy;
+    int64_t mp;
+    int64_t year;
+
+    days = secs / 86400;
+    rem = secs % 86400;
+    if(rem < 0)
+    {
+        rem += 86400;
+        days--;
+    }
+
+    date -> tm_hour = rem / 3600;
+    date -> tm_min = (rem % 3600) / 60;
+    date -> tm_sec = rem % 60;
+    date -> tm_wday = (days % 7 + 11) % 7;
+
+    days += EPOCH_DAYS;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    doe = days - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    year = yoe + era * 400;
+
+    date -> tm_mday = doy - (153 * mp + 2) / 5 + 1;
+    date -> tm_mon = mp < 10 ? mp + 2 : mp - 10;
+    if(date -> tm_mon <= 1)
+    {
+        year++;
+    }
+    date -> tm_year = year - 1900;
+
+    // Day of the year from 1st January
+    date -> tm_yday = doy >= 306 ? doy - 306 : doy + 59 + ((year % 4 == 0 && year % 100 != 0) || year % 400 == 0);
+    date -> tm_isdst = 0;
+}
+
+void rtcSetCaching(int resync)
+{
+    /**
+    * Serve rtcReadDate() and rtcNow() from CLOCK_MONOTONIC instead of the bus
+    * The RTC is read when caching starts, waiting up to a second for its
+    * seconds to roll over, then again every resync seconds to correct drift.
+    * @param resync - seconds between RTC reads, 0 to read the RTC every call
+    */
+
+    rtcResync = resync;
+    rtcAnchorValid = 0;
+}
+
+int rtcNow(struct timespec *now)
+{
+    /**
+    * Read the time as seconds and nanoseconds since the epoch
+    * With caching on this is a clock_gettime() and some arithmetic.
+    * Without it the RTC is read and tv_nsec is 0.
+    * If a resync fails the cached time carries on from the last good one.
+    * @param now - set to the current RTC time
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    struct tm date;
+    int64_t t;
+    int64_t mono;
+    int status;
+
+    if(rtcResync == 0)
+    {
+        status = rtc_read(&date);
+        if(status < 0)
+        {
+            return status;
+        }
+        now -> tv_sec = rtcEpoch(&date);
+        now -> tv_nsec = 0;
+        return 0;
+    }
+
+    status = 0;
+    mono = monotonic_ns();
+    if(rtcAnchorValid == 0 || mono - rtcAnchorMono >= rtcResync * NSEC)
+    {
+        status = rtc_sync();
+        if(status < 0 && rtcAnchorValid == 0)
+        {
+            return status;
+        }
+        mono = monotonic_ns();
+    }
+    else
+    {
+        i2cPerfCached(RTCADDRESS, SECONDS);
+    }
+
+    t = rtcAnchor + (mono - rtcAnchorMono);
+    now -> tv_sec = t / NSEC;
+    now -> tv_nsec = t % NSEC;
+
+    return status;
+}
+
+int64_t rtcGetDrift()
+{
+    /**
+    * Get the correction made to the cached time at the last resync
+    * @returns - nanoseconds, positive if the RTC was ahead of the cached time
     */
-    i2cWriteBuffer[0] = SECONDS; // register address for seconds
-    i2cWriteBuffer[1] = decToBcd(date -> tm_sec);
-    i2cWriteBuffer[2] = decToBcd(date -> tm_min);
-    i2cWriteBuffer[3] = decToBcd(date -> tm_hour);
-    i2cWriteBuffer[4] = decToBcd(date -> tm_wday);
-    i2cWriteBuffer[5] = decToBcd(date -> tm_mday);
-    i2cWriteBuffer[6] = decToBcd(date -> tm_mon) + 1;
-    i2cWriteBuffer[7] = decToBcd(date -> tm_year % 100);
 
-    i2cWriteByteArray(RTCADDRESS, i2cWriteBuffer, 8);
+    return rtcDrift;
 }
 
-void rtcReadDate(struct tm *date)
+int rtcReadDate(struct tm *date)
 {
     /**
     * Read the date from the RTC.
-    * @returns - date as a tm struct
+    * @returns - 0, or a negative errno on bus error.  date is set as a tm struct
     */
 
-    i2cReadByteArray(RTCADDRESS, 0, i2cReadBuffer, 7);
-    date -> tm_sec = bcdToDec(i2cReadBuffer[0]);
-    date -> tm_min = bcdToDec(i2cReadBuffer[1]);
-    date -> tm_hour = bcdToDec(i2cReadBuffer[2]);
-    date -> tm_wday = bcdToDec(i2cReadBuffer[3]);
-    date -> tm_mday = bcdToDec(i2cReadBuffer[4]);
-    date -> tm_mon = bcdToDec(i2cReadBuffer[5]) - 1;
-    date -> tm_year = bcdToDec(i2cReadBuffer[6]) + (CENTURY - 1900);
+    struct timespec now;
+    int status;
+
+    if(rtcResync == 0)
+    {
+        return rtc_read(date);
+    }
+
+    status = rtcNow(&now);
+    if(status < 0 && rtcAnchorValid == 0)
+    {
+        return status;
+    }
+    rtc_break_down(now.tv_sec, date);
+
+    return status;
 }
 
-void rtcEnableOutput()
+int rtcEnableOutput()
 {
     /**
     * Enable the squarewave output pin
+    * @returns - 0, or a negative errno on bus error
     */
     rtcConfig = i2cUpdateByte(rtcConfig, SQWE, 1);
-    i2cWriteByteData(RTCADDRESS, CONTROL, rtcConfig);
+    return i2cWriteByteData(I2C_DEFAULT_BUS, RTCADDRESS, CONTROL, rtcConfig);
 }
 
-void rtcDisableOutput()
+int rtcDisableOutput()
 {
     /**
     * Disable the squarewave output pin
+    * @returns - 0, or a negative errno on bus error
     */
     rtcConfig = i2cUpdateByte(rtcConfig, SQWE, 0);
-    i2cWriteByteData(RTCADDRESS, CONTROL, rtcConfig);
+    return i2cWriteByteData(I2C_DEFAULT_BUS, RTCADDRESS, CONTROL, rtcConfig);
 }
 
-void rtcSetFrequency(uint8_t frequency)
+int rtcSetFrequency(uint8_t frequency)
 {
     /**
     * Set the squarewave output frequency
     * @param frequency - 1 = 1Hz, 2 = 4.096KHz, 3 = 8.192KHz, 4 = 32.768KHz
+    * @returns - 0, or a negative errno on bus error
     */
     switch(frequency)
     {
@@ -131,31 +429,283 @@ void rtcSetFrequency(uint8_t frequency)
             break;
     }
 
-    i2cWriteByteData(RTCADDRESS, CONTROL, rtcConfig);
+    return i2cWriteByteData(I2C_DEFAULT_BUS, RTCADDRESS, CONTROL, rtcConfig);
 }
 
-void rtcWriteMemory(uint8_t address, int length, uint8_t *valuearray)
+static int memory_range_ok(uint8_t address, int length)
+{
+    return address >= RTCMEMSTART && length >= 0 && address + length <= RTCMEMSIZE;
+}
+
+int rtcWriteMemory(uint8_t address, int length, uint8_t *valuearray)
 {
     /**
     * write to the memory on the DS1307.  The DS1307 contains a 56-byte, battery-backed RAM with unlimited writes
+    * Nothing is written if the range is outside 0x08 to 0x3F
     * @param address - 0x08 to 0x3F
     * @param valuearray - byte array containing data to be written to memory
+    * @returns - 0, -1 if the range is outside the RAM, or a negative errno on bus error
     */
+    uint8_t wrBuffer[RTCMEMSIZE + 1];
+    int status;
+    int bulk;
+
+    if(!memory_range_ok(address, length))
+    {
+        return -1;
+    }
+
+    wrBuffer[0] = address;
+    bcopy(valuearray, &wrBuffer[1], length);
+    bulk = i2cBulkBegin(I2C_BULK_SPLIT);
+    status = i2cWriteByteArray(I2C_DEFAULT_BUS, RTCADDRESS, wrBuffer, length + 1);
+    i2cBulkEnd(bulk);
 
-    i2cWriteBuffer[0] = address;
-    bcopy(valuearray, &i2cWriteBuffer[1], length);
-    i2cWriteByteArray(RTCADDRESS, i2cWriteBuffer, (uint8_t)length + 1);
+    if(status == 0 && rtcNvramLoaded)
+    {
+        memcpy(&rtcNvram[address], valuearray, length);
+    }
+
+    return status;
 }
 
-void rtcReadMemory(uint8_t address, uint8_t length, uint8_t *readarray)
+int rtcReadMemory(uint8_t address, uint8_t length, uint8_t *readarray)
 {
     /**
     * Read from the memory on the DS1307
     * The DS1307 contains 56-Byte, battery-backed RAM with Unlimited Writes
+    * Nothing is read if the range is outside 0x08 to 0x3F
     * @param address - 0x08 to 0x3F
     * @param length - up to 32 bytes.  length can not exceed the available address space.
-    * @returns - pointer to a byte array where the data will be saved
+    * @param readarray - byte array where the data will be saved
+    * @returns - 0, -1 if the range is outside the RAM, or a negative errno on bus error
+    */
+
+    int status;
+    int bulk;
+
+    if(!memory_range_ok(address, length))
+    {
+        return -1;
+    }
+
+    bulk = i2cBulkBegin(I2C_BULK_SPLIT);
+    status = i2cReadByteArray(I2C_DEFAULT_BUS, RTCADDRESS, address, readarray, length);
+    i2cBulkEnd(bulk);
+
+    return status;
+}
+
+static uint16_t nvram_crc()
+{
+    uint16_t crc;
+    int address;
+    int bit;
+
+    // CRC-16/CCITT-FALSE
+    crc = 0xFFFF;
+    for(address = RTCMEMSTART; address < NVRAM_CRC; address++)
+    {
+        crc ^= rtcNvram[address] << 8;
+        for(bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+int rtcNvramLoad(int crc)
+{
+    /**
+    * Read all of the battery backed RAM into the host copy in one burst
+    * Reads and writes through rtcNvramRead() and rtcNvramWrite() then use
+    * the copy, and changes go back to the RTC when flushed.
+    * @param crc - 1 to keep a CRC-16 in the last two bytes (0x3E, 0x3F) which
+    *              leaves 0x08 to 0x3D for data, 0 to use all 56 bytes
+    * @returns - 0, -1 if crc is set and the stored CRC doesn't match, or a
+    *            negative errno on bus error
+    */
+
+    int status;
+    int bulk;
+
+    bulk = i2cBulkBegin(I2C_BULK_SPLIT);
+    status = i2cReadByteArray(I2C_DEFAULT_BUS, RTCADDRESS, RTCMEMSTART,
+                              &rtcNvram[RTCMEMSTART], RTCMEMSIZE - RTCMEMSTART);
+    i2cBulkEnd(bulk);
+    if(status < 0)
+    {
+        rtcNvramLoaded = 0;
+        return status;
+    }
+
+    rtcNvramLoaded = 1;
+    rtcNvramDirty = 0;
+    rtcNvramCrc = crc;
+
+    if(crc && nvram_crc() != ((rtcNvram[NVRAM_CRC] << 8) | rtcNvram[NVRAM_CRC + 1]))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+int rtcNvramRead(uint8_t address, int length, uint8_t *readarray)
+{
+    /**
+    * Read from the host copy of the battery backed RAM
+    * @param address - 0x08 to 0x3F
+    * @returns - 0, or -1 if not loaded or the range is outside the RAM
+    */
+
+    if(rtcNvramLoaded == 0 || !memory_range_ok(address, length))
+    {
+        return -1;
+    }
+
+    memcpy(readarray, &rtcNvram[address], length);
+    i2cPerfCached(RTCADDRESS, address);
+
+    return 0;
+}
+
+int rtcNvramWrite(uint8_t address, int length, uint8_t *valuearray)
+{
+    /**
+    * Write to the host copy of the battery backed RAM
+    * The bytes are sent by the next rtcNvramFlush(), or by rtcNvramPoll()
+    * once the auto flush interval has passed
+    * @param address - 0x08 to 0x3F, or 0x3D with CRC on
+    * @returns - 0, or -1 if not loaded or the range is outside the RAM
+    */
+
+    struct itimerspec arm;
+    int end;
+
+    end = rtcNvramCrc ? NVRAM_CRC : RTCMEMSIZE;
+    if(rtcNvramLoaded == 0 || !memory_range_ok(address, length) || address + length > end)
+    {
+        return -1;
+    }
+
+    if(length == 0 || memcmp(&rtcNvram[address], valuearray, length) == 0)
+    {
+        return 0;
+    }
+
+    if(rtcNvramDirty == 0 && rtcNvramInterval > 0)
+    {
+        rtcNvramDeadline = monotonic_ns() + (int64_t)rtcNvramInterval * 1000000;
+
+        memset(&arm, 0, sizeof(arm));
+        arm.it_value.tv_sec = rtcNvramInterval / 1000;
+        arm.it_value.tv_nsec = (rtcNvramInterval % 1000) * 1000000;
+        timerfd_settime(rtcNvramTimer, 0, &arm, NULL);
+    }
+
+    memcpy(&rtcNvram[address], valuearray, length);
+    rtcNvramDirty |= ((1ULL << length) - 1) << address;
+
+    return 0;
+}
+
+int rtcNvramFlush()
+{
+    /**
+    * Send changed bytes to the RTC as a single burst
+    * The burst runs from the first changed byte to the last, bytes in between
+    * that haven't changed are sent with the values they already have
+    * If the write fails the bytes stay marked changed for the next flush
+    * @returns - number of bytes sent, or a negative errno on bus error
+    */
+
+    uint8_t wrBuffer[RTCMEMSIZE + 1];
+    uint16_t crc;
+    int status;
+    int bulk;
+    int first;
+    int last;
+
+    if(rtcNvramDirty == 0)
+    {
+        return 0;
+    }
+
+    if(rtcNvramCrc)
+    {
+        crc = nvram_crc();
+        rtcNvram[NVRAM_CRC] = crc >> 8;
+        rtcNvram[NVRAM_CRC + 1] = crc & 0xFF;
+        rtcNvramDirty |= 3ULL << NVRAM_CRC;
+    }
+
+    first = __builtin_ctzll(rtcNvramDirty);
+    last = 63 - __builtin_clzll(rtcNvramDirty);
+
+    wrBuffer[0] = first;
+    memcpy(&wrBuffer[1], &rtcNvram[first], last - first + 1);
+    // Bulk class, but not split so the data and its CRC land together
+    bulk = i2cBulkBegin(0);
+    status = i2cWriteByteArray(I2C_DEFAULT_BUS, RTCADDRESS, wrBuffer, last - first + 2);
+    i2cBulkEnd(bulk);
+    if(status < 0)
+    {
+        return status;
+    }
+
+    rtcNvramDirty = 0;
+
+    return last - first + 1;
+}
+
+void rtcNvramSetAutoFlush(int interval)
+{
+    /**
+    * Flush changes automatically interval ms after the first unflushed write
+    * The flush happens in rtcNvramPoll(), call it when rtcNvramFd() polls
+    * readable or regularly from a main loop
+    * @param interval - milliseconds, 0 to only flush on rtcNvramFlush()
+    */
+
+    if(rtcNvramTimer < 0)
+    {
+        rtcNvramTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+
+    rtcNvramInterval = interval;
+}
+
+int rtcNvramFd()
+{
+    /**
+    * File descriptor that polls readable when an auto flush is due
+    * @returns - timerfd, -1 before rtcNvramSetAutoFlush()
     */
 
-   i2cReadByteArray(RTCADDRESS, address, readarray, length);
+    return rtcNvramTimer;
+}
+
+int rtcNvramPoll()
+{
+    /**
+    * Flush if the auto flush interval has passed since the first unflushed write
+    * @returns - number of bytes sent, or a negative errno on bus error
+    */
+
+    uint64_t expirations;
+
+    if(rtcNvramTimer >= 0)
+    {
+        read(rtcNvramTimer, &expirations, sizeof(expirations));
+    }
+
+    if(rtcNvramDirty == 0 || rtcNvramInterval == 0 || monotonic_ns() < rtcNvramDeadline)
+    {
+        return 0;
+    }
+
+    return rtcNvramFlush();
 }
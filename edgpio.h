@@ -10,6 +10,10 @@
 #include <stdint.h>
 #include <time.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Pin directions
 #define INPUT     1
 #define OUTPUT    0
@@ -32,42 +36,271 @@
 #define IO_PORTA  0
 #define IO_PORTB  1
 
+// Handle for one MCP23017, see ioOpen()
+typedef struct ioDevice ioDevice;
+
+// Pin event ring, see ioRingOpen()
+typedef struct ioRing ioRing;
+
+// Pattern output stream, see ioPatternOpen()
+typedef struct ioPattern ioPattern;
+
+// Input poller thread, see ioPollerOpen()
+typedef struct ioPoller ioPoller;
+
+// Burst capture timing, CLOCK_MONOTONIC nanoseconds.  Samples are evenly
+// spaced between start and end apart from gaps between transactions.
+struct ioCaptureTime
+{
+    uint64_t start;
+    uint64_t end;
+};
+
+// Every MCP23017 register, IODIRA (0x00) to OLATB (0x15), indexed by its
+// BANK=0 address.  See ioSnapshot().
+#define IO_REGISTERS 22
+
+struct ioRegisterSnapshot
+{
+    uint8_t regs[IO_REGISTERS];
+};
+
 // DS1307 RAM defines
 #define RTCMEMSTART 0x08
 #define RTCMEMSIZE  0x40
 
+// Count of system calls made on the I2C bus devices, and of transfers
+// retried and given up on
+struct i2cStats
+{
+    unsigned long opens;
+    unsigned long ioctls;
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long closes;
+    unsigned long retries;
+    unsigned long failures;
+    unsigned long timeouts;
+};
+
+// How bus errors are handled.  A failed transfer is tried again up to
+// attempts times in all, waiting backoff us before the first retry and
+// doubling each time up to maxBackoff us.  If deadline is non-zero a call
+// gives up with -ETIMEDOUT rather than run past deadline us in total.
+struct i2cRetryPolicy
+{
+    int attempts;
+    int backoff;
+    int maxBackoff;
+    int deadline;
+};
+
+// Bus priority classes, see i2cSetPriority().  AUTO takes the class from
+// the device address, or BULK for RTC memory and NVRAM transfers.
+#define I2C_CLASS_AUTO      -1
+#define I2C_CLASS_REALTIME  0
+#define I2C_CLASS_NORMAL    1
+#define I2C_CLASS_BULK      2
+#define I2C_CLASSES         3
+
+// Performance counters, see i2cperf.c.  All fields are uint64_t so the
+// struct can be read from a shared memory segment by another process.
+#define I2C_PERF_VERSION  2
+#define I2C_PERF_DEVICES  8
+#define I2C_PERF_REGS     64
+#define I2C_PERF_BUCKETS  32
+
+// Latency histograms
+#define I2C_PERF_OPEN       0
+#define I2C_PERF_IOCTL      1
+#define I2C_PERF_TRANSFER   2
+#define I2C_PERF_WAIT       3   // Waiting for the bus, plus the class
+#define I2C_PERF_HISTOGRAMS (I2C_PERF_WAIT + I2C_CLASSES)
+
+// Transfers to one register, and accesses served from a host copy of it
+struct i2cPerfReg
+{
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    uint64_t cached;
+};
+
+// address is 0x100 | the device address once the slot is used, 0 if free.
+// Registers are counted by the address a transfer starts at.
+struct i2cPerfDevice
+{
+    uint64_t address;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    uint64_t cached;
+    uint64_t errors;
+    uint64_t retries;
+    struct i2cPerfReg regs[I2C_PERF_REGS];
+};
+
+// buckets[0] counts 0 ns, buckets[n] counts 2^(n-1) to 2^n - 1 ns, the last
+// bucket takes everything longer
+struct i2cPerfHistogram
+{
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t buckets[I2C_PERF_BUCKETS];
+};
+
+struct i2cPerf
+{
+    uint64_t version;
+    uint64_t errors;
+    uint64_t retries;
+    uint64_t timeouts;
+    uint64_t missed[I2C_CLASSES];       // Deadlines passed waiting for the bus
+    struct i2cPerfHistogram latency[I2C_PERF_HISTOGRAMS];
+    struct i2cPerfDevice devices[I2C_PERF_DEVICES];
+};
+
+// Transfer trace, see i2ctrace.c.  Times are CLOCK_MONOTONIC ns, result is
+// 0 or a negative errno and each failed attempt has its own event.
+#define I2C_TRACE_JSON    0
+#define I2C_TRACE_BINARY  1
+#define I2C_TRACE_MAGIC   "EDGT"
+#define I2C_TRACE_VERSION 1
+
+struct i2cTraceEvent
+{
+    int64_t start;
+    int64_t end;
+    uint32_t thread;
+    int32_t result;
+    uint16_t length;
+    uint8_t address;
+    uint8_t reg;
+    uint8_t write;
+    uint8_t reserved[3];
+};
+
+// Start of a binary trace, count events follow
+struct i2cTraceHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+};
+
+// How transfers are done on a bus, see i2cSetTransport()
+#define I2C_TRANSPORT_AUTO      0
+#define I2C_TRANSPORT_RDWR      1
+#define I2C_TRANSPORT_READWRITE 2
+#define I2C_TRANSPORT_SMBUS     3
+#define I2C_TRANSPORT_SIM       4
+
+// Bus name for the simulator, picked automatically with I2C_TRANSPORT_AUTO
+#define I2C_SIM_BUS "sim"
+
 // Specify I2C bus and sizes of read and write buffers to use 
 void i2cInit(char *busDeviceName, int rdBuffSize, int wrBuffSize, int retries);
 
+// Close all cached I2C bus handles.  They are reopened on next use
+void i2cClose();
+
+// Set how bus errors are retried
+void i2cSetRetryPolicy(struct i2cRetryPolicy *policy);
+
+// Get the retry policy
+void i2cGetRetryPolicy(struct i2cRetryPolicy *policy);
+
+// Set the bus class and deadline in us (0 for none) of the calling thread's transfers
+int i2cSetPriority(int cls, int deadline);
+
+// Set the bus class of a device address for threads using I2C_CLASS_AUTO
+int i2cSetAddressClass(uint8_t address, int cls);
+
+// Split bulk transfers into chunks of bytes, 0 to not split them
+void i2cSetBulkChunk(int bytes);
+
+// Get the system call counters
+void i2cGetStats(struct i2cStats *copy);
+
+// Clear the system call counters
+void i2cResetStats();
+
+// Copy the performance counters
+void i2cPerfSnapshot(struct i2cPerf *copy);
+
+// Clear the performance counters
+void i2cPerfReset();
+
+// Keep the performance counters in POSIX shared memory name, eg. "/edgpio"
+int i2cPerfShare(char *name);
+
+// Record transfers into a ring of entries per thread, 0 for the default
+void i2cTraceEnable(int entries);
+
+// Stop recording transfers
+void i2cTraceDisable();
+
+// Write recorded transfers as I2C_TRACE_JSON or I2C_TRACE_BINARY
+int i2cTraceDump(char *fileName, int format);
+
+// Choose the transport for a bus before it is used.  Auto picks I2C_RDWR,
+// SMBus or read()/write() from what the adapter supports
+int i2cSetTransport(char *busDeviceName, int transport);
+
+// Name of the transport a bus uses, eg. "rdwr"
+char *i2cGetTransport(char *busDeviceName);
+
+// Simulator: MCP23017s at 0x20 - 0x27 and a DS1307 at 0x68
+// Put every simulated chip back to its power on state
+void i2cSimReset();
+
+// Make each transaction take transferNs plus byteNs per byte on the bus
+void i2cSimSetTiming(int byteNs, int transferNs);
+
+// Drive the input pins of a simulated MCP23017, bit 0 = pin 1
+void i2cSimSetInputs(uint8_t address, uint16_t values);
+
+// Get the levels a simulated MCP23017 drives on its output pins
+uint16_t i2cSimGetOutputs(uint8_t address);
+
+// Make the next count transactions to a simulated chip fail with error
+void i2cSimFail(uint8_t address, int count, int error);
+
+// Get a simulated chip's register without a bus transaction
+int i2cSimGetRegister(uint8_t address, uint8_t reg);
+
 // Set IO direction for an individual pin
-void ioSetPinDirection(uint8_t pin, uint8_t direction);
+int ioSetPinDirection(uint8_t pin, uint8_t direction);
 
 // Get IO direction for an individual pin
 uint8_t ioGetPinDirection(uint8_t pin);
 
 // Set direction for an IO port
-void ioSetPortDirection(uint8_t port, uint8_t direction);
+int ioSetPortDirection(uint8_t port, uint8_t direction);
 
 // Get the direction for an IO port
 uint8_t ioGetPortDirection(uint8_t port);
 
 // Set the internal 100K pull-up resistors for an individual pin
-void ioSetPinPullup(uint8_t pin, uint8_t value);
+int ioSetPinPullup(uint8_t pin, uint8_t value);
 
 // Get the pull-up resistor state for a pin
 uint8_t ioGetPinPullup(uint8_t pin);
 
 // Set the internal 100K pull-up resistors for the selected IO port
-void ioSetPortPullups(uint8_t port, uint8_t value);
+int ioSetPortPullups(uint8_t port, uint8_t value);
 
 // Get the internal 100K pull-up resistors for the selected IO port
 uint8_t ioGetPortPullups(uint8_t port);
 
 // Write to an individual pin 1 - 16
-void ioWritePin(uint8_t pin, uint8_t value);
+int ioWritePin(uint8_t pin, uint8_t value);
 
 // Write to all pins on the selected port
-void ioWritePort(uint8_t port, uint8_t value);
+int ioWritePort(uint8_t port, uint8_t value);
 
 // Read the value of an individual pin
 uint8_t ioReadPin(uint8_t pin);
@@ -78,26 +311,26 @@ uint8_t ioReadPort(uint8_t port);
 uint8_t ioReadOutputLatch(uint8_t port);
 
 // Sets the type of interrupt for each pin on the selected port
-void ioSetInterruptType(uint8_t port, uint8_t value);
+int ioSetInterruptType(uint8_t port, uint8_t value);
 
 // Get the type of interrupt for each pin on the selected port
 uint8_t ioGetInterruptType(uint8_t port);
 
 //These bits set the compare value for pins configured for interrupt-on-change on the selected port.
 //If the associated pin level is the opposite of the register bit, an interrupt occurs.
-void ioSetInterruptDefaults(uint8_t port, uint8_t value);
+int ioSetInterruptDefaults(uint8_t port, uint8_t value);
 
 // Get the compare value for pins configured for interrupt-on-change on the selected port.
 uint8_t ioGetInterruptDefaults(uint8_t port);
 
 // Enable interrupts for the selected pin
-void ioSetInterruptOnPin(uint8_t pin, uint8_t value);
+int ioSetInterruptOnPin(uint8_t pin, uint8_t value);
 
 // Get the interrupt-enable status for the selected pin
 uint8_t ioGetInterruptOnPin(uint8_t pin);
 
 // Enable interrupts for the pins on the selected port
-void ioSetInterruptOnPort(uint8_t port, uint8_t value);
+int ioSetInterruptOnPort(uint8_t port, uint8_t value);
 
 // Get the interrupt-enable status for the selected port
 uint8_t ioGetInterruptOnPort(uint8_t port);
@@ -109,30 +342,421 @@ uint8_t ioReadInterruptStatus(uint8_t port);
 uint8_t ioReadInterruptCapture(uint8_t port);
 
 // Acknowledge interrupts on port 
-void ioAckInterrupts(uint8_t port);
+int ioAckInterrupts(uint8_t port);
+
+// 16 bit versions of the port functions.  Port A is the low byte,
+// each call is a single burst so both ports are seen at the same time
+
+// Read all 16 pins
+uint16_t ioReadWord();
+
+// Write all 16 pins
+int ioWriteWord(uint16_t value);
+
+// Write the pins in mask to values together, in one transaction worked
+// out from the output latch copy.  Only ports with pins in mask are sent.
+int ioWritePinsMasked(uint16_t mask, uint16_t values);
+
+// Set the pins in mask high together
+int ioSetPins(uint16_t mask);
+
+// Set the pins in mask low together
+int ioClearPins(uint16_t mask);
+
+// Invert the pins in mask together
+int ioTogglePins(uint16_t mask);
+
+// Set the direction of the pins in mask, the others are left alone
+int ioSetDirectionMasked(uint16_t mask, uint16_t direction);
+
+// Set the pull-ups of the pins in mask, the others are left alone
+int ioSetPullupsMasked(uint16_t mask, uint16_t value);
+
+// Set direction for all 16 pins
+int ioSetWordDirection(uint16_t direction);
+
+// Get direction for all 16 pins
+uint16_t ioGetWordDirection();
+
+// Set the internal 100K pull-up resistors for all 16 pins
+int ioSetWordPullups(uint16_t value);
+
+// Get the internal 100K pull-up resistors for all 16 pins
+uint16_t ioGetWordPullups();
+
+// Set the type of interrupt for all 16 pins
+int ioSetWordInterruptType(uint16_t value);
+
+// Get the type of interrupt for all 16 pins
+uint16_t ioGetWordInterruptType();
+
+// Set the interrupt compare value for all 16 pins
+int ioSetWordInterruptDefaults(uint16_t value);
+
+// Get the interrupt compare value for all 16 pins
+uint16_t ioGetWordInterruptDefaults();
+
+// Enable interrupts for all 16 pins
+int ioSetInterruptOnWord(uint16_t value);
+
+// Get the interrupt-enable status for all 16 pins
+uint16_t ioGetInterruptOnWord();
+
+// Read the interrupt status for all 16 pins
+uint16_t ioReadWordInterruptStatus();
+
+// Read all 16 pins at the time of the last interrupt trigger
+uint16_t ioReadWordInterruptCapture();
+
+// Read INTF and INTCAP for all 16 pins in one burst, clears the interrupt
+int ioReadInterrupts(uint16_t *flags, uint16_t *capture);
+
+// Drive INTA and INTB from both ports
+int ioSetInterruptMirror(uint8_t value);
+
+// Log input samples and interrupt captures to a pin event ring
+void ioSetRing(ioRing *ring);
+
+// Read count samples of one port using byte mode, one byte per sample
+int ioCapturePort(uint8_t port, uint8_t *samples, int count, struct ioCaptureTime *time);
+
+// Read count samples of both ports using byte mode
+int ioCaptureWord(uint16_t *samples, int count, struct ioCaptureTime *time);
 
 // Initialise the MCP32017 IO chip
-void ioInit(uint8_t reset, uint8_t busAddress);
+int ioInit(uint8_t reset, uint8_t busAddress);
+
+// Start a batch of MCP23017 register writes
+void ioBegin();
+
+// Send the writes made since ioBegin() as sequential bursts
+int ioCommit();
+
+// Forget the cached MCP23017 configuration, it is reloaded on next use
+void ioInvalidateCache();
+
+// Reload the cached MCP23017 configuration from the chip now
+int ioResyncCache();
+
+// Read all MCP23017 registers in one burst
+int ioSnapshot(struct ioRegisterSnapshot *snapshot);
+
+// Get a mask of the registers that differ between two snapshots
+uint32_t ioDiff(struct ioRegisterSnapshot *a, struct ioRegisterSnapshot *b);
+
+// Write the registers that differ between two snapshots, as bursts.
+// -1 if either has IOCON BANK or SEQOP set.
+int ioApply(struct ioRegisterSnapshot *from, struct ioRegisterSnapshot *to);
+
+// Get and clear the first bus error, reads return 0 when the bus fails
+int ioGetError();
+
+// Multiple MCP23017s
+// Each ioDevXXXX function does the same as ioXXXX on the device given.
+// ioXXXX functions use a default device on the bus given to i2cInit().
+
+// Open an MCP23017 at busAddress on busDeviceName
+ioDevice *ioOpen(char *busDeviceName, uint8_t busAddress, uint8_t reset);
+
+// Free a device handle
+void ioClose(ioDevice *dev);
+
+// Get the device used by the ioXXXX functions
+ioDevice *ioDefaultDevice();
+
+// Functions that write return 0, or a negative errno on bus error.  Functions
+// that read return 0 on bus error and keep it for ioDevGetError().
+
+int ioDevSetPinDirection(ioDevice *dev, uint8_t pin, uint8_t direction);
+uint8_t ioDevGetPinDirection(ioDevice *dev, uint8_t pin);
+int ioDevSetPortDirection(ioDevice *dev, uint8_t port, uint8_t direction);
+uint8_t ioDevGetPortDirection(ioDevice *dev, uint8_t port);
+int ioDevSetPinPullup(ioDevice *dev, uint8_t pin, uint8_t value);
+uint8_t ioDevGetPinPullup(ioDevice *dev, uint8_t pin);
+int ioDevSetPortPullups(ioDevice *dev, uint8_t port, uint8_t value);
+uint8_t ioDevGetPortPullups(ioDevice *dev, uint8_t port);
+int ioDevWritePin(ioDevice *dev, uint8_t pin, uint8_t value);
+int ioDevWritePort(ioDevice *dev, uint8_t port, uint8_t value);
+uint8_t ioDevReadPin(ioDevice *dev, uint8_t pin);
+uint8_t ioDevReadPort(ioDevice *dev, uint8_t port);
+uint8_t ioDevReadOutputLatch(ioDevice *dev, uint8_t port);
+int ioDevSetInterruptType(ioDevice *dev, uint8_t port, uint8_t value);
+uint8_t ioDevGetInterruptType(ioDevice *dev, uint8_t port);
+int ioDevSetInterruptDefaults(ioDevice *dev, uint8_t port, uint8_t value);
+uint8_t ioDevGetInterruptDefaults(ioDevice *dev, uint8_t port);
+int ioDevSetInterruptOnPin(ioDevice *dev, uint8_t pin, uint8_t value);
+uint8_t ioDevGetInterruptOnPin(ioDevice *dev, uint8_t pin);
+int ioDevSetInterruptOnPort(ioDevice *dev, uint8_t port, uint8_t value);
+uint8_t ioDevGetInterruptOnPort(ioDevice *dev, uint8_t port);
+uint8_t ioDevReadInterruptStatus(ioDevice *dev, uint8_t port);
+uint8_t ioDevReadInterruptCapture(ioDevice *dev, uint8_t port);
+int ioDevAckInterrupts(ioDevice *dev, uint8_t port);
+uint16_t ioDevReadWord(ioDevice *dev);
+int ioDevWriteWord(ioDevice *dev, uint16_t value);
+int ioDevWritePinsMasked(ioDevice *dev, uint16_t mask, uint16_t values);
+int ioDevSetPins(ioDevice *dev, uint16_t mask);
+int ioDevClearPins(ioDevice *dev, uint16_t mask);
+int ioDevTogglePins(ioDevice *dev, uint16_t mask);
+int ioDevSetDirectionMasked(ioDevice *dev, uint16_t mask, uint16_t direction);
+int ioDevSetPullupsMasked(ioDevice *dev, uint16_t mask, uint16_t value);
+int ioDevSetWordDirection(ioDevice *dev, uint16_t direction);
+uint16_t ioDevGetWordDirection(ioDevice *dev);
+int ioDevSetWordPullups(ioDevice *dev, uint16_t value);
+uint16_t ioDevGetWordPullups(ioDevice *dev);
+int ioDevSetWordInterruptType(ioDevice *dev, uint16_t value);
+uint16_t ioDevGetWordInterruptType(ioDevice *dev);
+int ioDevSetWordInterruptDefaults(ioDevice *dev, uint16_t value);
+uint16_t ioDevGetWordInterruptDefaults(ioDevice *dev);
+int ioDevSetInterruptOnWord(ioDevice *dev, uint16_t value);
+uint16_t ioDevGetInterruptOnWord(ioDevice *dev);
+uint16_t ioDevReadWordInterruptStatus(ioDevice *dev);
+uint16_t ioDevReadWordInterruptCapture(ioDevice *dev);
+int ioDevReadInterrupts(ioDevice *dev, uint16_t *flags, uint16_t *capture);
+int ioDevSetInterruptMirror(ioDevice *dev, uint8_t value);
+void ioDevSetRing(ioDevice *dev, ioRing *ring);
+void ioDevSetPoller(ioDevice *dev, ioPoller *poller);
+int ioDevSampleInputs(ioDevice *dev, uint16_t *gpio, uint16_t *flags, uint16_t *capture);
+int ioDevCapturePort(ioDevice *dev, uint8_t port, uint8_t *samples, int count, struct ioCaptureTime *time);
+int ioDevCaptureWord(ioDevice *dev, uint16_t *samples, int count, struct ioCaptureTime *time);
+void ioDevBegin(ioDevice *dev);
+int ioDevCommit(ioDevice *dev);
+void ioDevInvalidateCache(ioDevice *dev);
+int ioDevResyncCache(ioDevice *dev);
+int ioDevSnapshot(ioDevice *dev, struct ioRegisterSnapshot *snapshot);
+int ioDevApply(ioDevice *dev, struct ioRegisterSnapshot *from, struct ioRegisterSnapshot *to);
+int ioDevGetError(ioDevice *dev);
 
 // Set the date on the RTC
-void rtcSetDate(struct tm *date);
+int rtcSetDate(struct tm *date);
 
 // Read the date from the RTC.
-void rtcReadDate(struct tm *date);
+int rtcReadDate(struct tm *date);
+
+// Convert a date to seconds since the epoch, faster than mktime()
+time_t rtcEpoch(struct tm *date);
+
+// Read the RTC every resync seconds and extrapolate in between, 0 = off
+void rtcSetCaching(int resync);
+
+// Get the RTC time in seconds and nanoseconds
+int rtcNow(struct timespec *now);
+
+// Get the drift corrected at the last resync in nanoseconds
+int64_t rtcGetDrift();
 
 // Enable the square wave output pin
-void rtcEnableOutput();
+int rtcEnableOutput();
 
 // Disable the square wave output pin
-void rtcDisableOutput();
+int rtcDisableOutput();
 
 // Set the square wave output frequency
-void rtcSetFrequency(uint8_t frequency);
+int rtcSetFrequency(uint8_t frequency);
 
 // Write to the memory on the DS1307.  
-void rtcWriteMemory(uint8_t address, int length, uint8_t *valuearray);
+int rtcWriteMemory(uint8_t address, int length, uint8_t *valuearray);
 
 // Read from the memory on the DS1307
-void rtcReadMemory(uint8_t address, uint8_t length, uint8_t *writearray);
+int rtcReadMemory(uint8_t address, uint8_t length, uint8_t *writearray);
+
+// Load the DS1307 memory into a host copy, optionally checked by a CRC
+int rtcNvramLoad(int crc);
+
+// Read from the host copy of the DS1307 memory
+int rtcNvramRead(uint8_t address, int length, uint8_t *readarray);
+
+// Write to the host copy of the DS1307 memory
+int rtcNvramWrite(uint8_t address, int length, uint8_t *valuearray);
+
+// Send changes to the DS1307 in one burst
+int rtcNvramFlush();
+
+// Flush automatically interval ms after the first change
+void rtcNvramSetAutoFlush(int interval);
+
+// timerfd that polls readable when an auto flush is due
+int rtcNvramFd();
+
+// Flush if an auto flush is due
+int rtcNvramPoll();
+
+// Asynchronous requests
+// A worker thread per engine runs requests in submission order, use one
+// engine per bus.  Submitting returns 0, or -1 if depth requests are
+// already in flight.  When a request finishes its callback is given the
+// result (0 = OK, or a negative errno) and for reads the value read.
+
+// Completion modes for i2cAsyncOpen()
+#define I2C_ASYNC_CALLBACK 0
+#define I2C_ASYNC_EVENTFD  1
+
+typedef struct i2cAsync i2cAsync;
+typedef void (*i2cCallback)(void *context, int result, uint32_t value);
+
+// Start an engine with up to depth requests in flight
+i2cAsync *i2cAsyncOpen(int depth, int mode);
+
+// Finish queued requests and stop the engine
+void i2cAsyncClose(i2cAsync *async);
+
+// eventfd that polls readable when completions are waiting
+int i2cAsyncFd(i2cAsync *async);
+
+// Call callbacks for finished requests on this thread
+int i2cAsyncComplete(i2cAsync *async);
+
+int ioDevReadPinAsync(i2cAsync *async, ioDevice *dev, uint8_t pin, i2cCallback callback, void *context);
+int ioDevWritePinAsync(i2cAsync *async, ioDevice *dev, uint8_t pin, uint8_t value, i2cCallback callback, void *context);
+int ioDevReadPortAsync(i2cAsync *async, ioDevice *dev, uint8_t port, i2cCallback callback, void *context);
+int ioDevWritePortAsync(i2cAsync *async, ioDevice *dev, uint8_t port, uint8_t value, i2cCallback callback, void *context);
+int ioDevReadWordAsync(i2cAsync *async, ioDevice *dev, i2cCallback callback, void *context);
+int ioDevWriteWordAsync(i2cAsync *async, ioDevice *dev, uint16_t value, i2cCallback callback, void *context);
+
+int ioReadPinAsync(i2cAsync *async, uint8_t pin, i2cCallback callback, void *context);
+int ioWritePinAsync(i2cAsync *async, uint8_t pin, uint8_t value, i2cCallback callback, void *context);
+int ioReadPortAsync(i2cAsync *async, uint8_t port, i2cCallback callback, void *context);
+int ioWritePortAsync(i2cAsync *async, uint8_t port, uint8_t value, i2cCallback callback, void *context);
+int ioReadWordAsync(i2cAsync *async, i2cCallback callback, void *context);
+int ioWriteWordAsync(i2cAsync *async, uint16_t value, i2cCallback callback, void *context);
+
+// date, readarray and valuearray must stay valid until the callback
+int rtcReadDateAsync(i2cAsync *async, struct tm *date, i2cCallback callback, void *context);
+int rtcSetDateAsync(i2cAsync *async, struct tm *date, i2cCallback callback, void *context);
+int rtcReadMemoryAsync(i2cAsync *async, uint8_t address, uint8_t length, uint8_t *readarray, i2cCallback callback, void *context);
+int rtcWriteMemoryAsync(i2cAsync *async, uint8_t address, int length, uint8_t *valuearray, i2cCallback callback, void *context);
+
+// Pin change events
+// Wait on a host GPIO line wired to the MCP23017 INTA/INTB output instead
+// of polling the chip.  The callback gets the pin (1 - 16), its captured
+// value and the kernel timestamp of the edge in nanoseconds.
+
+typedef struct ioEvents ioEvents;
+typedef void (*ioEventCallback)(void *context, ioDevice *dev, uint8_t pin, uint8_t value, uint64_t timestamp);
+
+// Request lineOffset on gpioChip for interrupts from dev
+ioEvents *ioEventsOpen(ioDevice *dev, char *gpioChip, int lineOffset);
+
+// Use a line already requested with rising edge detection, eg. through
+// libgpiod, or a pipe of struct gpio_v2_line_event for testing
+ioEvents *ioEventsOpenFd(ioDevice *dev, int lineFd);
+
+// Release the line
+void ioEventsClose(ioEvents *events);
+
+// File descriptor that polls readable when an interrupt is waiting
+int ioEventsFd(ioEvents *events);
+
+// Set the callback for a pin, 0 for every pin
+int ioEventsOnPin(ioEvents *events, uint8_t pin, ioEventCallback callback, void *context);
+
+// Wait up to timeout ms for an interrupt and deliver its events
+int ioEventsWait(ioEvents *events, int timeout);
+
+// Pin event ring
+// Lock-free fixed size queue of timestamped port samples.  Devices log to
+// it with ioSetRing(), any thread may push, one thread drains.
+
+struct ioPinEvent
+{
+    uint64_t timestamp;     // CLOCK_MONOTONIC nanoseconds
+    ioDevice *dev;
+    uint8_t port;           // IO_PORTA or IO_PORTB
+    uint8_t value;          // port value
+    uint8_t changed;        // bits that changed or caused the interrupt
+};
+
+// Create a ring holding capacity events
+ioRing *ioRingOpen(int capacity);
+
+// Free a ring
+void ioRingClose(ioRing *ring);
+
+// Add an event, returns -1 if the ring is full
+int ioRingPush(ioRing *ring, struct ioPinEvent *event);
+
+// Add an event stamped with the current time
+int ioRingRecord(ioRing *ring, ioDevice *dev, uint8_t port, uint8_t value, uint8_t changed);
+
+// Take up to max events, returns the number taken
+int ioRingDrain(ioRing *ring, struct ioPinEvent *events, int max);
+
+// Number of events dropped because the ring was full
+unsigned long ioRingOverflows(ioRing *ring);
+
+// Input debounce
+// Filters 16 bit samples of both ports and reports settled changes only.
+// Each pin has its own filter type and time constant.
+
+// Filter types for ioDebounceSetPin()
+#define DEBOUNCE_COUNTER    0
+#define DEBOUNCE_INTEGRATOR 1
+
+typedef struct ioDebounce ioDebounce;
+
+// Create a filter for samples taken every samplePeriod us
+ioDebounce *ioDebounceOpen(int samplePeriod, uint16_t initial);
+
+// Free a filter
+void ioDebounceClose(ioDebounce *db);
+
+// Set the filter type and time constant in us for a pin
+int ioDebounceSetPin(ioDebounce *db, uint8_t pin, int mode, int time);
+
+// Feed a 16 bit sample, returns the pins that changed state
+uint16_t ioDebounceSample(ioDebounce *db, uint16_t sample);
+
+// Feed a sample of one port, returns the pins that changed state
+uint16_t ioDebounceSamplePort(ioDebounce *db, uint8_t port, uint8_t value);
+
+// Get the settled state of all 16 pins
+uint16_t ioDebounceState(ioDebounce *db);
+
+// Input poller
+// One thread reads the inputs of a device at a fixed rate and publishes
+// them under a seqlock.  While it runs the device's pin, port and word
+// reads return the latest sample without using the bus, from any thread.
+
+// Also read INTF and INTCAP, which acknowledges interrupts
+#define IO_POLL_INTERRUPTS 1
+
+struct ioInputSnapshot
+{
+    uint16_t gpio;
+    uint16_t flags;         // INTF, with IO_POLL_INTERRUPTS
+    uint16_t capture;       // INTCAP, with IO_POLL_INTERRUPTS
+    int error;              // 0, or the negative errno of the last sample
+    uint64_t timestamp;     // CLOCK_MONOTONIC ns of the last good sample
+    uint64_t age;           // ns since timestamp when read
+    uint64_t samples;       // Samples taken
+};
+
+// Start polling a device every period us
+ioPoller *ioPollerOpen(ioDevice *dev, int period, int flags);
+
+// Stop polling and free the poller
+void ioPollerClose(ioPoller *poller);
+
+// Get the latest sample, returns its error
+int ioPollerRead(ioPoller *poller, struct ioInputSnapshot *snapshot);
+
+// Pattern output
+// Streams buffers of port values to the output latches in byte mode, each
+// byte on the bus is a new output state.
+
+// Start 8 bit (one port) or 16 bit (both ports) pattern output
+ioPattern *ioPatternOpen(ioDevice *dev, int width, uint8_t port);
+
+// Output count values, call again to feed more
+int ioPatternWrite(ioPattern *pat, void *values, int count);
+
+// Output count values loops times
+int ioPatternLoop(ioPattern *pat, void *values, int count, int loops);
+
+// Stop pattern output and restore the device
+void ioPatternClose(ioPattern *pat);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -0,0 +1,195 @@
+//
+// C++ pin maps for Ed's RTC and GPIO board
+//
+//   Pin<Port, Bit> names one MCP23017 pin and PinGroup<Pins...> a set of
+//   them.  Ports, bits and masks are template arguments so a bad pin fails
+//   to compile, and a group works out at compile time whether it reads
+//   port A, port B or both.  Each group operation is one register write
+//   (or one read) through the masked C API, which takes the bits outside
+//   the group from the host copy and writes nothing if that can't be read.
+//
+//     typedef edgpio::Pin<IO_PORTA, 0> Led;
+//     typedef edgpio::PinGroup<edgpio::Pin<IO_PORTA, 4>,
+//                              edgpio::Pin<IO_PORTB, 2>> Relays;
+//
+//     Relays::output(dev);
+//     Relays::write(dev, true, false);
+//
+//   Needs C++17.  Values given as a uint16_t use the ioReadWord() layout,
+//   bit 0 = port A bit 0, bit 8 = port B bit 0.  Reads return 0 on bus
+//   error and keep the error for ioDevGetError(), like the C API.
+//
+
+#ifndef __GOT_EDGPIO_HPP
+#define __GOT_EDGPIO_HPP
+
+#include <stdint.h>
+
+#include "edgpio.h"
+
+namespace edgpio
+{
+
+namespace detail
+{
+
+// Read the bits of a register pair in Mask, one port if that covers it
+template<uint16_t Mask,
+         uint8_t (*GetPort)(ioDevice *, uint8_t),
+         uint16_t (*GetWord)(ioDevice *)>
+inline uint16_t fetch(ioDevice *dev)
+{
+    if constexpr ((Mask >> 8) == 0)
+    {
+        return GetPort(dev, IO_PORTA) & Mask;
+    }
+    else if constexpr ((Mask & 0xFF) == 0)
+    {
+        return (GetPort(dev, IO_PORTB) << 8) & Mask;
+    }
+    else
+    {
+        return GetWord(dev) & Mask;
+    }
+}
+
+// Output latch as a word, both halves come from the host copy
+inline uint16_t readLatchWord(ioDevice *dev)
+{
+    return ioDevReadOutputLatch(dev, IO_PORTA) | (ioDevReadOutputLatch(dev, IO_PORTB) << 8);
+}
+
+// Spread one bool per pin over the pins' word bits
+template<uint16_t... Masks, typename... Values>
+constexpr uint16_t pack(Values... values)
+{
+    return ((values ? Masks : 0) | ... | 0);
+}
+
+} // namespace detail
+
+template<typename... Pins>
+struct PinGroup
+{
+    static_assert(sizeof...(Pins) > 0, "PinGroup needs at least one pin");
+    static_assert((Pins::mask + ...) == (Pins::mask | ...), "PinGroup has a pin twice");
+
+    // Bits of the group in the ioReadWord() layout
+    static constexpr uint16_t mask = (Pins::mask | ...);
+
+    // Set the pins in mask to the matching bits of values
+    static int write(ioDevice *dev, uint16_t values)
+    {
+        return ioDevWritePinsMasked(dev, mask, values);
+    }
+
+    // Set each pin in order to the matching argument
+    template<typename... Values>
+    static int write(ioDevice *dev, bool first, Values... rest)
+    {
+        static_assert(sizeof...(Values) + 1 == sizeof...(Pins), "One value per pin");
+        return write(dev, detail::pack<Pins::mask...>(first, rest...));
+    }
+
+    static int set(ioDevice *dev = ioDefaultDevice())
+    {
+        return ioDevSetPins(dev, mask);
+    }
+
+    static int clear(ioDevice *dev = ioDefaultDevice())
+    {
+        return ioDevClearPins(dev, mask);
+    }
+
+    static int toggle(ioDevice *dev = ioDefaultDevice())
+    {
+        return ioDevTogglePins(dev, mask);
+    }
+
+    // Input levels of the pins, other bits 0
+    static uint16_t read(ioDevice *dev = ioDefaultDevice())
+    {
+        return detail::fetch<mask, ioDevReadPort, ioDevReadWord>(dev);
+    }
+
+    // Levels last written to the pins, from the host copy
+    static uint16_t latch(ioDevice *dev = ioDefaultDevice())
+    {
+        return detail::readLatchWord(dev) & mask;
+    }
+
+    static int output(ioDevice *dev = ioDefaultDevice())
+    {
+        return ioDevSetDirectionMasked(dev, mask, 0);
+    }
+
+    static int input(ioDevice *dev = ioDefaultDevice())
+    {
+        return ioDevSetDirectionMasked(dev, mask, mask);
+    }
+
+    static int pullup(ioDevice *dev, bool enable)
+    {
+        return ioDevSetPullupsMasked(dev, mask, enable ? mask : 0);
+    }
+};
+
+template<uint8_t Port, uint8_t Bit>
+struct Pin
+{
+    static_assert(Port == IO_PORTA || Port == IO_PORTB, "Port must be IO_PORTA or IO_PORTB");
+    static_assert(Bit < 8, "Bit must be 0 to 7");
+
+    static constexpr uint8_t port = Port;
+    static constexpr uint8_t bit = Bit;
+
+    // Pin number for the C API, 1 to 16
+    static constexpr uint8_t number = Port * 8 + Bit + 1;
+
+    // Bit in the ioReadWord() layout
+    static constexpr uint16_t mask = 1 << (Port * 8 + Bit);
+
+    static int write(ioDevice *dev, bool value)
+    {
+        return PinGroup<Pin>::write(dev, (uint16_t)(value ? mask : 0));
+    }
+
+    static int set(ioDevice *dev = ioDefaultDevice())
+    {
+        return PinGroup<Pin>::set(dev);
+    }
+
+    static int clear(ioDevice *dev = ioDefaultDevice())
+    {
+        return PinGroup<Pin>::clear(dev);
+    }
+
+    static int toggle(ioDevice *dev = ioDefaultDevice())
+    {
+        return PinGroup<Pin>::toggle(dev);
+    }
+
+    static bool read(ioDevice *dev = ioDefaultDevice())
+    {
+        return PinGroup<Pin>::read(dev) != 0;
+    }
+
+    static int output(ioDevice *dev = ioDefaultDevice())
+    {
+        return PinGroup<Pin>::output(dev);
+    }
+
+    static int input(ioDevice *dev = ioDefaultDevice())
+    {
+        return PinGroup<Pin>::input(dev);
+    }
+
+    static int pullup(ioDevice *dev, bool enable)
+    {
+        return PinGroup<Pin>::pullup(dev, enable);
+    }
+};
+
+} // namespace edgpio
+
+#endif
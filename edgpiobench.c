@@ -0,0 +1,369 @@
+/* Measure latency, throughput and system calls per call for the edgpio
+ * public API
+ *
+ *   edgpiobench [-n iterations] [-f text|json|csv] [-t transport]
+ *               [-b byte ns] <i2c bus device>
+ *
+ * Needs an MCP23017 at 0x20 and a DS1307 at 0x68 on the bus, or use the bus
+ * "sim" to run against the simulator with -b setting the time per byte on
+ * the simulated bus.  -t picks auto, rdwr, readwrite or smbus to compare
+ * transports on one adapter, the i2c-stub module needs smbus.  Every call is
+ * timed on its own, the results give the 50th and 99th percentile and
+ * worst case latency, calls per second over the whole run, system calls per
+ * call and the number of calls that failed.  json and csv output are for
+ * keeping results and comparing runs.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "edgpio.h"
+
+#define ITERATIONS 1000
+
+#define FORMAT_TEXT 0
+#define FORMAT_JSON 1
+#define FORMAT_CSV  2
+
+// Returns 0, or a negative errno if the call failed
+typedef int (*benchFn)();
+
+struct benchResult
+{
+    char *name;
+    int64_t p50;
+    int64_t p99;
+    int64_t max;
+    double callsPerSec;
+    double syscalls;
+    struct i2cStats stats;
+    int errors;
+};
+
+static int benchWritePin()
+{
+    return ioWritePin(1, ON);
+}
+
+static int benchReadPin()
+{
+    ioReadPin(9);
+    return ioGetError();
+}
+
+static int benchWritePort()
+{
+    return ioWritePort(IO_PORTA, 0x55);
+}
+
+static int benchReadPort()
+{
+    ioReadPort(IO_PORTB);
+    return ioGetError();
+}
+
+static int benchWriteWord()
+{
+    return ioWriteWord(0x00AA);
+}
+
+static int benchReadWord()
+{
+    ioReadWord();
+    return ioGetError();
+}
+
+static int benchGetPinDirection()
+{
+    ioGetPinDirection(1);
+    return ioGetError();
+}
+
+static int benchReadInterrupts()
+{
+    uint16_t flags;
+    uint16_t capture;
+
+    return ioReadInterrupts(&flags, &capture);
+}
+
+static int benchInit()
+{
+    return ioInit(1, 0);
+}
+
+static int benchReadDate()
+{
+    struct tm date;
+
+    return rtcReadDate(&date);
+}
+
+static int benchReadMemory()
+{
+    uint8_t data[8];
+
+    return rtcReadMemory(RTCMEMSTART, sizeof(data), data);
+}
+
+static int benchWriteMemory()
+{
+    uint8_t data[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+    return rtcWriteMemory(RTCMEMSTART, sizeof(data), data);
+}
+
+static struct
+{
+    char *name;
+    benchFn fn;
+} benchmarks[] =
+{
+    { "ioWritePin",        benchWritePin },
+    { "ioReadPin",         benchReadPin },
+    { "ioWritePort",       benchWritePort },
+    { "ioReadPort",        benchReadPort },
+    { "ioWriteWord",       benchWriteWord },
+    { "ioReadWord",        benchReadWord },
+    { "ioGetPinDirection", benchGetPinDirection },
+    { "ioReadInterrupts",  benchReadInterrupts },
+    { "ioInit",            benchInit },
+    { "rtcReadDate",       benchReadDate },
+    { "rtcReadMemory",     benchReadMemory },
+    { "rtcWriteMemory",    benchWriteMemory },
+    { NULL,                NULL }
+};
+
+static int64_t nowNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int compareNs(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of sorted samples
+static int64_t percentile(int64_t *sorted, int count, int pct)
+{
+    int rank;
+
+    rank = (count * pct + 99) / 100;
+    if(rank < 1)
+    {
+        rank = 1;
+    }
+
+    return sorted[rank - 1];
+}
+
+static void runBench(char *name, benchFn fn, int64_t *samples, int iterations, struct benchResult *r)
+{
+    struct i2cStats *s;
+    int64_t start;
+    int64_t total;
+    int c;
+
+    // One untimed call so first-use opens don't skew the figures
+    fn();
+
+    r -> name = name;
+    r -> errors = 0;
+
+    i2cResetStats();
+    total = nowNs();
+    for(c = 0; c < iterations; c++)
+    {
+        start = nowNs();
+        if(fn() < 0)
+        {
+            r -> errors++;
+        }
+        samples[c] = nowNs() - start;
+    }
+    total = nowNs() - total;
+    i2cGetStats(&r -> stats);
+
+    qsort(samples, iterations, sizeof(int64_t), compareNs);
+
+    s = &r -> stats;
+    r -> p50 = percentile(samples, iterations, 50);
+    r -> p99 = percentile(samples, iterations, 99);
+    r -> max = samples[iterations - 1];
+    r -> callsPerSec = total > 0 ? iterations * 1e9 / total : 0;
+    r -> syscalls = (double)(s -> opens + s -> ioctls + s -> reads + s -> writes + s -> closes) / iterations;
+}
+
+static char *transportNames[] = { "auto", "rdwr", "readwrite", "smbus", "sim", NULL };
+
+static void printHeader(int format, char *bus, int iterations)
+{
+    switch(format)
+    {
+        case FORMAT_JSON:
+            printf("{\n  \"bus\": \"%s\",\n  \"transport\": \"%s\",\n  \"iterations\": %d,\n  \"results\": [\n",
+                   bus, i2cGetTransport(bus), iterations);
+            break;
+
+        case FORMAT_CSV:
+            printf("call,p50_ns,p99_ns,max_ns,calls_per_sec,syscalls_per_call,"
+                   "opens,ioctls,reads,writes,closes,retries,errors\n");
+            break;
+
+        default:
+            printf("%s using %s\n", bus, i2cGetTransport(bus));
+            printf("%-20s %10s %10s %10s %10s %9s %7s\n",
+                   "call", "p50 us", "p99 us", "max us", "calls/s", "syscalls", "errors");
+            break;
+    }
+}
+
+static void printResult(int format, struct benchResult *r, int last)
+{
+    struct i2cStats *s;
+
+    s = &r -> stats;
+    switch(format)
+    {
+        case FORMAT_JSON:
+            printf("    { \"call\": \"%s\", \"p50_ns\": %lld, \"p99_ns\": %lld, \"max_ns\": %lld, "
+                   "\"calls_per_sec\": %.1f, \"syscalls_per_call\": %.3f, "
+                   "\"opens\": %lu, \"ioctls\": %lu, \"reads\": %lu, \"writes\": %lu, \"closes\": %lu, "
+                   "\"retries\": %lu, \"errors\": %d }%s\n",
+                   r -> name, (long long)r -> p50, (long long)r -> p99, (long long)r -> max,
+                   r -> callsPerSec, r -> syscalls,
+                   s -> opens, s -> ioctls, s -> reads, s -> writes, s -> closes,
+                   s -> retries, r -> errors, last ? "" : ",");
+            break;
+
+        case FORMAT_CSV:
+            printf("%s,%lld,%lld,%lld,%.1f,%.3f,%lu,%lu,%lu,%lu,%lu,%lu,%d\n",
+                   r -> name, (long long)r -> p50, (long long)r -> p99, (long long)r -> max,
+                   r -> callsPerSec, r -> syscalls,
+                   s -> opens, s -> ioctls, s -> reads, s -> writes, s -> closes,
+                   s -> retries, r -> errors);
+            break;
+
+        default:
+            printf("%-20s %10.1f %10.1f %10.1f %10.0f %9.2f %7d\n",
+                   r -> name, r -> p50 / 1e3, r -> p99 / 1e3, r -> max / 1e3,
+                   r -> callsPerSec, r -> syscalls, r -> errors);
+            break;
+    }
+}
+
+static void printFooter(int format)
+{
+    if(format == FORMAT_JSON)
+    {
+        printf("  ]\n}\n");
+    }
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-f text|json|csv] [-t transport] [-b byte ns] <i2c bus device>\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct benchResult result;
+    int64_t *samples;
+    int iterations;
+    int format;
+    int transport;
+    int opt;
+    int b;
+
+    iterations = ITERATIONS;
+    format = FORMAT_TEXT;
+    transport = I2C_TRANSPORT_AUTO;
+
+    while((opt = getopt(argc, argv, "n:f:t:b:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+
+            case 't':
+                for(transport = 0; transportNames[transport] != NULL; transport++)
+                {
+                    if(strcmp(optarg, transportNames[transport]) == 0)
+                    {
+                        break;
+                    }
+                }
+                if(transportNames[transport] == NULL)
+                {
+                    usage(argv[0]);
+                }
+                break;
+
+            case 'b':
+                i2cSimSetTiming(atoi(optarg), 0);
+                break;
+
+            case 'f':
+                if(strcmp(optarg, "json") == 0)
+                {
+                    format = FORMAT_JSON;
+                }
+                else if(strcmp(optarg, "csv") == 0)
+                {
+                    format = FORMAT_CSV;
+                }
+                else if(strcmp(optarg, "text") != 0)
+                {
+                    usage(argv[0]);
+                }
+                break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(optind >= argc || iterations < 1)
+    {
+        usage(argv[0]);
+    }
+
+    i2cInit(argv[optind], 32, 32, 10);
+    i2cSetTransport(argv[optind], transport);
+    if(ioInit(1, 0) < 0)
+    {
+        fprintf(stderr, "No MCP23017 on %s\n", argv[optind]);
+        exit(1);
+    }
+    ioSetPortDirection(IO_PORTA, 0x00);
+
+    samples = malloc(iterations * sizeof(int64_t));
+
+    printHeader(format, argv[optind], iterations);
+    for(b = 0; benchmarks[b].name != NULL; b++)
+    {
+        runBench(benchmarks[b].name, benchmarks[b].fn, samples, iterations, &result);
+        printResult(format, &result, benchmarks[b + 1].name == NULL);
+    }
+    printFooter(format);
+
+    free(samples);
+    i2cClose();
+
+    return 0;
+}
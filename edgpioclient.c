@@ -0,0 +1,745 @@
+/* edgpiod client
+ *
+ * The MCP23017 pin, port and word functions of edgpio.h, done through a
+ * running edgpiod rather than the bus.  Link with libedgpioclient.a in place
+ * of libedgpio.a.  The daemon's socket is $EDGPIOD_SOCKET or
+ * EDGPIOD_SOCKET, and i2cInit() just records nothing so programs build
+ * unchanged.
+ *
+ * Reads come from the state the daemon publishes in shared memory: no
+ * system call, inputs as fresh as the daemon's poll period, outputs and
+ * configuration exactly as last written by any client.  Writes are queued
+ * to the daemon and return once they have been done, with the result.
+ * Interrupts, captures, patterns and the RTC are not available here.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+
+#include "edgpio.h"
+#include "edgpiod.h"
+
+// Default I2C address for MCP23017
+#define IOADDRESS 0x20
+
+// How long to wait for the daemon before giving up on a command
+#define WAIT_SEC 1
+
+// Published register words
+#define REG_GPIO  0
+#define REG_OLAT  1
+#define REG_IODIR 2
+#define REG_GPPU  3
+
+struct ioDevice
+{
+    uint8_t address;
+    int slot;
+    int error;
+};
+
+static struct edgpiodShared *shared;
+static int doorbell = -1;
+static pthread_mutex_t connectLock = PTHREAD_MUTEX_INITIALIZER;
+static ioDevice ioDefault = { IOADDRESS, -1, 0 };
+
+// Get the shared memory and doorbell from the daemon, once
+static int client_connect()
+{
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct edgpiodShared *map;
+    char version;
+    char *path;
+    int fds[2];
+    int status;
+    int fd;
+
+    if(__atomic_load_n(&shared, __ATOMIC_ACQUIRE) != NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&connectLock);
+    if(shared != NULL)
+    {
+        pthread_mutex_unlock(&connectLock);
+        return 0;
+    }
+
+    path = getenv("EDGPIOD_SOCKET");
+    if(path == NULL)
+    {
+        path = EDGPIOD_SOCKET;
+    }
+
+    status = -ECONNREFUSED;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if(fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        iov.iov_base = &version;
+        iov.iov_len = 1;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsg = NULL;
+        if(recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) == 1 && version == EDGPIOD_VERSION)
+        {
+            cmsg = CMSG_FIRSTHDR(&msg);
+        }
+        if(cmsg != NULL && cmsg -> cmsg_type == SCM_RIGHTS && cmsg -> cmsg_len == CMSG_LEN(sizeof(fds)))
+        {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+            map = mmap(NULL, sizeof(struct edgpiodShared), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+            close(fds[0]);
+            if(map != MAP_FAILED)
+            {
+                doorbell = fds[1];
+                __atomic_store_n(&shared, map, __ATOMIC_RELEASE);
+                status = 0;
+            }
+            else
+            {
+                close(fds[1]);
+            }
+        }
+    }
+
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+    pthread_mutex_unlock(&connectLock);
+
+    return status;
+}
+
+// Slot the daemon publishes address in, -ENODEV if it doesn't have it
+static int find_device(uint8_t address)
+{
+    int slot;
+
+    for(slot = 0; slot < EDGPIOD_DEVICES; slot++)
+    {
+        if(__atomic_load_n(&shared -> devices[slot].address, __ATOMIC_RELAXED) == address)
+        {
+            return slot;
+        }
+    }
+
+    return -ENODEV;
+}
+
+static int dev_status(ioDevice *dev, int status)
+{
+    if(status < 0 && dev -> error == 0)
+    {
+        dev -> error = status;
+    }
+
+    return status;
+}
+
+// Wait for a shared word to move on from seen, -ETIMEDOUT if it doesn't
+static int wait_change(uint32_t *word, uint32_t seen)
+{
+    struct timespec timeout;
+
+    timeout.tv_sec = WAIT_SEC;
+    timeout.tv_nsec = 0;
+
+    if(syscall(SYS_futex, word, FUTEX_WAIT, seen, &timeout, NULL, 0) < 0 && errno == ETIMEDOUT)
+    {
+        return -ETIMEDOUT;
+    }
+
+    return 0;
+}
+
+// Give back a place in the queue, waking anyone waiting for one
+static void release_place()
+{
+    if(__atomic_fetch_sub(&shared -> inFlight, 1, __ATOMIC_RELEASE) == EDGPIOD_QUEUE)
+    {
+        syscall(SYS_futex, &shared -> inFlight, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// Queue a command for the daemon and wait for its result
+static int submit(ioDevice *dev, uint32_t op, uint16_t clear, uint16_t set, uint16_t flip)
+{
+    struct edgpiodSlot *slot;
+    struct edgpiodResult *res;
+    uint64_t pos;
+    uint32_t seen;
+    uint32_t state;
+    uint32_t n;
+    int64_t result;
+    uint64_t one;
+
+    if(dev -> slot < 0)
+    {
+        return dev_status(dev, -ENODEV);
+    }
+
+    // Reserve a place, waiting for one to be given back if the queue is full
+    n = __atomic_load_n(&shared -> inFlight, __ATOMIC_RELAXED);
+    for(;;)
+    {
+        if(n >= EDGPIOD_QUEUE)
+        {
+            if(wait_change(&shared -> inFlight, n) < 0 && __atomic_load_n(&shared -> inFlight, __ATOMIC_RELAXED) == n)
+            {
+                return dev_status(dev, -ETIMEDOUT);
+            }
+            n = __atomic_load_n(&shared -> inFlight, __ATOMIC_RELAXED);
+            continue;
+        }
+        if(__atomic_compare_exchange_n(&shared -> inFlight, &n, n + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+
+    pos = __atomic_fetch_add(&shared -> tail, 1, __ATOMIC_RELAXED);
+    res = &shared -> results[pos & (EDGPIOD_QUEUE - 1)];
+    __atomic_store_n(&res -> state, EDGPIOD_WAITING, __ATOMIC_RELAXED);
+    slot = &shared -> slots[pos & (EDGPIOD_QUEUE - 1)];
+    slot -> command.op = op;
+    slot -> command.address = dev -> address;
+    slot -> command.clear = clear;
+    slot -> command.set = set;
+    slot -> command.flip = flip;
+    __atomic_store_n(&slot -> ready, 1, __ATOMIC_SEQ_CST);
+
+    if(__atomic_exchange_n(&shared -> sleeping, 0, __ATOMIC_SEQ_CST))
+    {
+        one = 1;
+        write(doorbell, &one, sizeof(one));
+    }
+
+    // done is the low 32 bits of the count run, wait until it passes pos
+    for(;;)
+    {
+        seen = __atomic_load_n(&shared -> done, __ATOMIC_ACQUIRE);
+        if((int32_t)(seen - (uint32_t)(pos + 1)) >= 0)
+        {
+            break;
+        }
+        if(wait_change(&shared -> done, seen) < 0 && __atomic_load_n(&shared -> done, __ATOMIC_ACQUIRE) == seen)
+        {
+            // Leave the place to the daemon, unless it finished meanwhile
+            state = EDGPIOD_WAITING;
+            if(__atomic_compare_exchange_n(&res -> state, &state, EDGPIOD_ABANDONED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                return dev_status(dev, -ETIMEDOUT);
+            }
+            break;
+        }
+    }
+
+    // The entry is ours until the place is given back, a different ticket
+    // means the shared memory has been overwritten
+    result = -ESTALE;
+    if(__atomic_load_n(&res -> ticket, __ATOMIC_ACQUIRE) == pos)
+    {
+        result = __atomic_load_n(&res -> result, __ATOMIC_RELAXED);
+    }
+    release_place();
+
+    return dev_status(dev, result);
+}
+
+// Read one published register word under the device's seqlock
+static uint16_t get_word(ioDevice *dev, int reg)
+{
+    struct edgpiodDevice *d;
+    uint32_t seq;
+    uint16_t value;
+    int32_t error;
+
+    if(dev -> slot < 0)
+    {
+        dev_status(dev, -ENODEV);
+        return 0;
+    }
+
+    d = &shared -> devices[dev -> slot];
+    do
+    {
+        seq = __atomic_load_n(&d -> seq, __ATOMIC_ACQUIRE);
+        switch(reg)
+        {
+            case REG_GPIO:
+                value = __atomic_load_n(&d -> gpio, __ATOMIC_RELAXED);
+                break;
+
+            case REG_OLAT:
+                value = __atomic_load_n(&d -> olat, __ATOMIC_RELAXED);
+                break;
+
+            case REG_IODIR:
+                value = __atomic_load_n(&d -> iodir, __ATOMIC_RELAXED);
+                break;
+
+            default:
+                value = __atomic_load_n(&d -> gppu, __ATOMIC_RELAXED);
+                break;
+        }
+        error = __atomic_load_n(&d -> error, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while((seq & 1) || __atomic_load_n(&d -> seq, __ATOMIC_RELAXED) != seq);
+
+    // The daemon's last poll of the inputs failed
+    if(reg == REG_GPIO && error < 0)
+    {
+        dev_status(dev, error);
+    }
+
+    return value;
+}
+
+static int set_pin(ioDevice *dev, uint8_t pin, uint8_t value, uint32_t op)
+{
+    uint16_t mask;
+
+    if(pin < 1 || pin > 16)
+    {
+        return -1;
+    }
+
+    mask = 1 << (pin - 1);
+
+    return submit(dev, op, mask, value ? mask : 0, 0);
+}
+
+static uint8_t get_pin(ioDevice *dev, uint8_t pin, int reg)
+{
+    if(pin < 1 || pin > 16)
+    {
+        return -1;
+    }
+
+    return (get_word(dev, reg) >> (pin - 1)) & 1;
+}
+
+static int set_port(ioDevice *dev, uint8_t port, uint8_t value, uint32_t op)
+{
+    if(port != IO_PORTA && port != IO_PORTB)
+    {
+        return -1;
+    }
+
+    return submit(dev, op, 0xFF << (port * 8), value << (port * 8), 0);
+}
+
+static uint8_t get_port(ioDevice *dev, uint8_t port, int reg)
+{
+    if(port != IO_PORTA && port != IO_PORTB)
+    {
+        return -1;
+    }
+
+    return get_word(dev, reg) >> (port * 8);
+}
+
+/*===============================Public Functions===============================*/
+
+void i2cInit(char *busDeviceName, int rdBuffSize, int wrBuffSize, int retries)
+{
+    /**
+    * Nothing to do, the daemon owns the bus
+    */
+
+    (void)busDeviceName;
+    (void)rdBuffSize;
+    (void)wrBuffSize;
+    (void)retries;
+}
+
+void i2cClose()
+{
+    /**
+    * Nothing to do, the daemon owns the bus
+    */
+}
+
+ioDevice *ioOpen(char *busDeviceName, uint8_t busAddress, uint8_t reset)
+{
+    /**
+    * Open an MCP23017 the daemon looks after
+    * @param busDeviceName - ignored, the daemon has one bus
+    * @param busAddress - 0x20 to 0x27
+    * @param reset - If set to 1 reset registers to default values, for
+    *                every client of the daemon
+    * @returns - handle to pass to the ioDevXXXX functions, NULL if the daemon
+    *            isn't running or doesn't have the device
+    */
+
+    ioDevice *dev;
+    int slot;
+
+    (void)busDeviceName;
+
+    if(client_connect() < 0)
+    {
+        return NULL;
+    }
+
+    slot = find_device(busAddress);
+    if(slot < 0)
+    {
+        return NULL;
+    }
+
+    dev = calloc(1, sizeof(ioDevice));
+    dev -> address = busAddress;
+    dev -> slot = slot;
+
+    if(reset == 1 && submit(dev, EDGPIOD_RESET, 0, 0, 0) < 0)
+    {
+        free(dev);
+        return NULL;
+    }
+
+    return dev;
+}
+
+ioDevice *ioDefaultDevice()
+{
+    return &ioDefault;
+}
+
+void ioClose(ioDevice *dev)
+{
+    free(dev);
+}
+
+int ioDevGetError(ioDevice *dev)
+{
+    /**
+    * Get and clear the first error since the last call
+    * @returns - 0, or a negative errno eg. -ETIMEDOUT if the daemon didn't answer
+    */
+
+    int error;
+
+    error = dev -> error;
+    dev -> error = 0;
+
+    return error;
+}
+
+int ioDevSetPinDirection(ioDevice *dev, uint8_t pin, uint8_t direction)
+{
+    return set_pin(dev, pin, direction, EDGPIOD_IODIR);
+}
+
+uint8_t ioDevGetPinDirection(ioDevice *dev, uint8_t pin)
+{
+    return get_pin(dev, pin, REG_IODIR);
+}
+
+int ioDevSetPortDirection(ioDevice *dev, uint8_t port, uint8_t direction)
+{
+    return set_port(dev, port, direction, EDGPIOD_IODIR);
+}
+
+uint8_t ioDevGetPortDirection(ioDevice *dev, uint8_t port)
+{
+    return get_port(dev, port, REG_IODIR);
+}
+
+int ioDevSetPinPullup(ioDevice *dev, uint8_t pin, uint8_t value)
+{
+    return set_pin(dev, pin, value, EDGPIOD_GPPU);
+}
+
+uint8_t ioDevGetPinPullup(ioDevice *dev, uint8_t pin)
+{
+    return get_pin(dev, pin, REG_GPPU);
+}
+
+int ioDevSetPortPullups(ioDevice *dev, uint8_t port, uint8_t value)
+{
+    return set_port(dev, port, value, EDGPIOD_GPPU);
+}
+
+uint8_t ioDevGetPortPullups(ioDevice *dev, uint8_t port)
+{
+    return get_port(dev, port, REG_GPPU);
+}
+
+int ioDevWritePin(ioDevice *dev, uint8_t pin, uint8_t value)
+{
+    return set_pin(dev, pin, value, EDGPIOD_OLAT);
+}
+
+int ioDevWritePort(ioDevice *dev, uint8_t port, uint8_t value)
+{
+    return set_port(dev, port, value, EDGPIOD_OLAT);
+}
+
+uint8_t ioDevReadPin(ioDevice *dev, uint8_t pin)
+{
+    return get_pin(dev, pin, REG_GPIO);
+}
+
+uint8_t ioDevReadPort(ioDevice *dev, uint8_t port)
+{
+    return get_port(dev, port, REG_GPIO);
+}
+
+uint8_t ioDevReadOutputLatch(ioDevice *dev, uint8_t port)
+{
+    return get_port(dev, port, REG_OLAT);
+}
+
+uint16_t ioDevReadWord(ioDevice *dev)
+{
+    return get_word(dev, REG_GPIO);
+}
+
+int ioDevWriteWord(ioDevice *dev, uint16_t value)
+{
+    return submit(dev, EDGPIOD_OLAT, 0xFFFF, value, 0);
+}
+
+int ioDevWritePinsMasked(ioDevice *dev, uint16_t mask, uint16_t values)
+{
+    return submit(dev, EDGPIOD_OLAT, mask, values & mask, 0);
+}
+
+int ioDevSetPins(ioDevice *dev, uint16_t mask)
+{
+    return submit(dev, EDGPIOD_OLAT, 0, mask, 0);
+}
+
+int ioDevClearPins(ioDevice *dev, uint16_t mask)
+{
+    return submit(dev, EDGPIOD_OLAT, mask, 0, 0);
+}
+
+int ioDevTogglePins(ioDevice *dev, uint16_t mask)
+{
+    return submit(dev, EDGPIOD_OLAT, 0, 0, mask);
+}
+
+int ioDevSetDirectionMasked(ioDevice *dev, uint16_t mask, uint16_t direction)
+{
+    return submit(dev, EDGPIOD_IODIR, mask, direction & mask, 0);
+}
+
+int ioDevSetPullupsMasked(ioDevice *dev, uint16_t mask, uint16_t value)
+{
+    return submit(dev, EDGPIOD_GPPU, mask, value & mask, 0);
+}
+
+int ioDevSetWordDirection(ioDevice *dev, uint16_t direction)
+{
+    return submit(dev, EDGPIOD_IODIR, 0xFFFF, direction, 0);
+}
+
+uint16_t ioDevGetWordDirection(ioDevice *dev)
+{
+    return get_word(dev, REG_IODIR);
+}
+
+int ioDevSetWordPullups(ioDevice *dev, uint16_t value)
+{
+    return submit(dev, EDGPIOD_GPPU, 0xFFFF, value, 0);
+}
+
+uint16_t ioDevGetWordPullups(ioDevice *dev)
+{
+    return get_word(dev, REG_GPPU);
+}
+
+/*===============================Default Device===============================*/
+
+int ioInit(uint8_t reset, uint8_t busAddress)
+{
+    /**
+    * Use the daemon's MCP23017 at busAddress for the ioXXXX functions
+    * @param reset - If set to 1 reset registers to default values, for
+    *                every client of the daemon
+    * @param busAddress - if non-zero, use this as i2c bus address for MCP23017, otherwise use default
+    * @returns - 0, or a negative errno if the daemon isn't running or doesn't have the device
+    */
+
+    int status;
+
+    ioDefault.address = busAddress != 0 ? busAddress : IOADDRESS;
+    ioDefault.slot = -1;
+
+    status = client_connect();
+    if(status < 0)
+    {
+        return status;
+    }
+
+    ioDefault.slot = find_device(ioDefault.address);
+    if(ioDefault.slot < 0)
+    {
+        return -ENODEV;
+    }
+
+    if(reset == 1)
+    {
+        return submit(&ioDefault, EDGPIOD_RESET, 0, 0, 0);
+    }
+
+    return 0;
+}
+
+int ioGetError()
+{
+    return ioDevGetError(&ioDefault);
+}
+
+int ioSetPinDirection(uint8_t pin, uint8_t direction)
+{
+    return ioDevSetPinDirection(&ioDefault, pin, direction);
+}
+
+uint8_t ioGetPinDirection(uint8_t pin)
+{
+    return ioDevGetPinDirection(&ioDefault, pin);
+}
+
+int ioSetPortDirection(uint8_t port, uint8_t direction)
+{
+    return ioDevSetPortDirection(&ioDefault, port, direction);
+}
+
+uint8_t ioGetPortDirection(uint8_t port)
+{
+    return ioDevGetPortDirection(&ioDefault, port);
+}
+
+int ioSetPinPullup(uint8_t pin, uint8_t value)
+{
+    return ioDevSetPinPullup(&ioDefault, pin, value);
+}
+
+uint8_t ioGetPinPullup(uint8_t pin)
+{
+    return ioDevGetPinPullup(&ioDefault, pin);
+}
+
+int ioSetPortPullups(uint8_t port, uint8_t value)
+{
+    return ioDevSetPortPullups(&ioDefault, port, value);
+}
+
+uint8_t ioGetPortPullups(uint8_t port)
+{
+    return ioDevGetPortPullups(&ioDefault, port);
+}
+
+int ioWritePin(uint8_t pin, uint8_t value)
+{
+    return ioDevWritePin(&ioDefault, pin, value);
+}
+
+int ioWritePort(uint8_t port, uint8_t value)
+{
+    return ioDevWritePort(&ioDefault, port, value);
+}
+
+uint8_t ioReadPin(uint8_t pin)
+{
+    return ioDevReadPin(&ioDefault, pin);
+}
+
+uint8_t ioReadPort(uint8_t port)
+{
+    return ioDevReadPort(&ioDefault, port);
+}
+
+uint8_t ioReadOutputLatch(uint8_t port)
+{
+    return ioDevReadOutputLatch(&ioDefault, port);
+}
+
+uint16_t ioReadWord()
+{
+    return ioDevReadWord(&ioDefault);
+}
+
+int ioWriteWord(uint16_t value)
+{
+    return ioDevWriteWord(&ioDefault, value);
+}
+
+int ioWritePinsMasked(uint16_t mask, uint16_t values)
+{
+    return ioDevWritePinsMasked(&ioDefault, mask, values);
+}
+
+int ioSetPins(uint16_t mask)
+{
+    return ioDevSetPins(&ioDefault, mask);
+}
+
+int ioClearPins(uint16_t mask)
+{
+    return ioDevClearPins(&ioDefault, mask);
+}
+
+int ioTogglePins(uint16_t mask)
+{
+    return ioDevTogglePins(&ioDefault, mask);
+}
+
+int ioSetDirectionMasked(uint16_t mask, uint16_t direction)
+{
+    return ioDevSetDirectionMasked(&ioDefault, mask, direction);
+}
+
+int ioSetPullupsMasked(uint16_t mask, uint16_t value)
+{
+    return ioDevSetPullupsMasked(&ioDefault, mask, value);
+}
+
+int ioSetWordDirection(uint16_t direction)
+{
+    return ioDevSetWordDirection(&ioDefault, direction);
+}
+
+uint16_t ioGetWordDirection()
+{
+    return ioDevGetWordDirection(&ioDefault);
+}
+
+int ioSetWordPullups(uint16_t value)
+{
+    return ioDevSetWordPullups(&ioDefault, value);
+}
+
+uint16_t ioGetWordPullups()
+{
+    return ioDevGetWordPullups(&ioDefault);
+}
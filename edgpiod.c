@@ -0,0 +1,537 @@
+/* edgpiod - owns an I2C bus and its MCP23017s on behalf of other processes
+ *
+ *   edgpiod [-s socket] [-p poll ms] <i2c bus device> <address>...
+ *
+ * The daemon opens each MCP23017 once and keeps the only register cache.
+ * Programs linked with libedgpioclient.a connect to the socket and share
+ * a memory segment with the daemon:
+ *  - the input, output latch, direction and pull-up registers of every
+ *    device are published there under a seqlock, so reading them is a few
+ *    memory loads.  Inputs are polled every poll ms (default 10), output
+ *    pins read back their latch straight after a write.
+ *  - writes go through a lock-free command queue.  The daemon is woken
+ *    through an eventfd only when it is idle, and wakes the writer with a
+ *    futex once the command has run and the new state is published.
+ *
+ * Use the bus "sim" to run against the simulator.
+*/
+
+// accept4() and memfd_create()
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+
+#include "edgpio.h"
+#include "edgpiod.h"
+
+#define POLL_MS 10
+
+// Clients can write anywhere in shared, so the daemon keeps its own copy
+// of everything it acts on and only publishes it there
+static struct edgpiodShared *shared;
+static ioDevice *devices[EDGPIOD_DEVICES];
+static uint8_t addresses[EDGPIOD_DEVICES];
+static uint64_t head;
+static char *busName;
+static volatile sig_atomic_t stopping;
+
+static void onSignal(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+static uint16_t latchWord(ioDevice *dev)
+{
+    return ioDevReadOutputLatch(dev, IO_PORTA) | (ioDevReadOutputLatch(dev, IO_PORTB) << 8);
+}
+
+static int64_t nowNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Publish a device's registers under its seqlock, the daemon is the only
+// writer so its own fields can be read plainly.  With readBack output pins
+// in gpio take their latch value.  If the register cache can't be reloaded
+// the last published copy stays, with the error.
+static void publish(int slot, uint16_t gpio, uint64_t updated, int error, int readBack)
+{
+    struct edgpiodDevice *d;
+    ioDevice *dev;
+    uint16_t olat;
+    uint16_t iodir;
+    uint16_t gppu;
+    uint32_t seq;
+    int status;
+
+    d = &shared -> devices[slot];
+    dev = devices[slot];
+
+    ioDevGetError(dev);
+    olat = latchWord(dev);
+    iodir = ioDevGetWordDirection(dev);
+    gppu = ioDevGetWordPullups(dev);
+    status = ioDevGetError(dev);
+    if(status < 0)
+    {
+        olat = d -> olat;
+        iodir = d -> iodir;
+        gppu = d -> gppu;
+        if(error == 0)
+        {
+            error = status;
+        }
+    }
+    if(readBack)
+    {
+        gpio = (gpio & iodir) | (olat & ~iodir);
+    }
+
+    seq = d -> seq;
+    __atomic_store_n(&d -> seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&d -> gpio, gpio, __ATOMIC_RELAXED);
+    __atomic_store_n(&d -> updated, updated, __ATOMIC_RELAXED);
+    __atomic_store_n(&d -> error, error, __ATOMIC_RELAXED);
+    __atomic_store_n(&d -> olat, olat, __ATOMIC_RELAXED);
+    __atomic_store_n(&d -> iodir, iodir, __ATOMIC_RELAXED);
+    __atomic_store_n(&d -> gppu, gppu, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&d -> seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void pollDevices()
+{
+    struct edgpiodDevice *d;
+    uint16_t gpio;
+    int error;
+    int slot;
+
+    for(slot = 0; slot < EDGPIOD_DEVICES && devices[slot] != NULL; slot++)
+    {
+        d = &shared -> devices[slot];
+
+        ioDevGetError(devices[slot]);
+        gpio = ioDevReadWord(devices[slot]);
+        error = ioDevGetError(devices[slot]);
+        if(error < 0)
+        {
+            gpio = d -> gpio;
+        }
+
+        publish(slot, gpio, nowNs(), error, 0);
+    }
+}
+
+// Apply ((old & ~clear) | set) ^ flip to a register pair, writing one port
+// if the change is inside it.  old is read with getWord, and nothing is
+// written if that fails.
+static int updatePair(ioDevice *dev, struct edgpiodCommand *cmd,
+                      uint16_t (*getWord)(ioDevice *),
+                      int (*setPort)(ioDevice *, uint8_t, uint8_t),
+                      int (*setWord)(ioDevice *, uint16_t))
+{
+    uint16_t touched;
+    uint16_t value;
+    uint16_t old;
+    int status;
+
+    touched = cmd -> clear | cmd -> set | cmd -> flip;
+    if(touched == 0)
+    {
+        return 0;
+    }
+
+    ioDevGetError(dev);
+    old = getWord(dev);
+    status = ioDevGetError(dev);
+    if(status < 0)
+    {
+        return status;
+    }
+
+    value = ((old & ~cmd -> clear) | cmd -> set) ^ cmd -> flip;
+    if((touched & 0xFF00) == 0)
+    {
+        return setPort(dev, IO_PORTA, value & 0xFF);
+    }
+    if((touched & 0x00FF) == 0)
+    {
+        return setPort(dev, IO_PORTB, value >> 8);
+    }
+
+    return setWord(dev, value);
+}
+
+static int runCommand(struct edgpiodCommand *cmd)
+{
+    struct edgpiodDevice *d;
+    ioDevice *dev;
+    int status;
+    int slot;
+
+    for(slot = 0; slot < EDGPIOD_DEVICES && devices[slot] != NULL; slot++)
+    {
+        if(addresses[slot] == cmd -> address)
+        {
+            break;
+        }
+    }
+    if(slot == EDGPIOD_DEVICES || devices[slot] == NULL)
+    {
+        return -ENODEV;
+    }
+
+    dev = devices[slot];
+    switch(cmd -> op)
+    {
+        case EDGPIOD_OLAT:
+            status = updatePair(dev, cmd, latchWord, ioDevWritePort, ioDevWriteWord);
+            break;
+
+        case EDGPIOD_IODIR:
+            status = updatePair(dev, cmd, ioDevGetWordDirection, ioDevSetPortDirection, ioDevSetWordDirection);
+            break;
+
+        case EDGPIOD_GPPU:
+            status = updatePair(dev, cmd, ioDevGetWordPullups, ioDevSetPortPullups, ioDevSetWordPullups);
+            break;
+
+        case EDGPIOD_RESET:
+            dev = ioOpen(busName, cmd -> address, 1);
+            if(dev == NULL)
+            {
+                return -EIO;
+            }
+            ioClose(devices[slot]);
+            devices[slot] = dev;
+            status = 0;
+            break;
+
+        default:
+            return -EINVAL;
+    }
+
+    // Output pins read back their latch, inputs keep the last poll
+    d = &shared -> devices[slot];
+    publish(slot, d -> gpio, d -> updated, d -> error, 1);
+
+    return status;
+}
+
+// Give back a place in the queue for a client that stopped waiting
+static void releasePlace()
+{
+    if(__atomic_fetch_sub(&shared -> inFlight, 1, __ATOMIC_RELEASE) == EDGPIOD_QUEUE)
+    {
+        syscall(SYS_futex, &shared -> inFlight, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// Run everything queued
+static void runQueue()
+{
+    struct edgpiodCommand cmd;
+    struct edgpiodSlot *slot;
+    struct edgpiodResult *res;
+    int result;
+    int ran;
+
+    ran = 0;
+    for(;;)
+    {
+        slot = &shared -> slots[head & (EDGPIOD_QUEUE - 1)];
+        if(__atomic_load_n(&slot -> ready, __ATOMIC_ACQUIRE) == 0)
+        {
+            break;
+        }
+        cmd = slot -> command;
+        __atomic_store_n(&slot -> ready, 0, __ATOMIC_RELAXED);
+
+        result = runCommand(&cmd);
+
+        // The submitter owns the entry until it gives its place back
+        res = &shared -> results[head & (EDGPIOD_QUEUE - 1)];
+        __atomic_store_n(&res -> result, result, __ATOMIC_RELAXED);
+        __atomic_store_n(&res -> ticket, head, __ATOMIC_RELEASE);
+        if(__atomic_exchange_n(&res -> state, EDGPIOD_DONE, __ATOMIC_ACQ_REL) == EDGPIOD_ABANDONED)
+        {
+            releasePlace();
+        }
+
+        head++;
+        __atomic_store_n(&shared -> head, head, __ATOMIC_RELAXED);
+        __atomic_store_n(&shared -> done, (uint32_t)head, __ATOMIC_RELEASE);
+        ran = 1;
+    }
+
+    if(ran)
+    {
+        syscall(SYS_futex, &shared -> done, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// Hand a new client the shared memory and the doorbell
+static void acceptClient(int listenFd, int memFd, int doorbell)
+{
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    char version;
+    int fds[2];
+    int fd;
+
+    fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if(fd < 0)
+    {
+        return;
+    }
+
+    version = EDGPIOD_VERSION;
+    iov.iov_base = &version;
+    iov.iov_len = 1;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    fds[0] = memFd;
+    fds[1] = doorbell;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg -> cmsg_level = SOL_SOCKET;
+    cmsg -> cmsg_type = SCM_RIGHTS;
+    cmsg -> cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    sendmsg(fd, &msg, MSG_NOSIGNAL);
+    close(fd);
+}
+
+static int listenOn(char *path)
+{
+    struct sockaddr_un addr;
+    int probe;
+    int error;
+    int fd;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // Only replace a socket left behind, not one a daemon is listening on
+    probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    error = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0 ? 0 : errno;
+    if(probe >= 0)
+    {
+        close(probe);
+    }
+    if(error == 0)
+    {
+        close(fd);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    if(error == ECONNREFUSED)
+    {
+        unlink(path);
+    }
+
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-s socket] [-p poll ms] <i2c bus device> <address>...\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct epoll_event events[4];
+    struct epoll_event ev;
+    struct itimerspec arm;
+    struct sigaction sa;
+    char *socketPath;
+    uint8_t address;
+    int listenFd;
+    int doorbell;
+    int timer;
+    int memFd;
+    int epfd;
+    int pollMs;
+    uint64_t count;
+    int pending;
+    int opt;
+    int n;
+    int c;
+
+    socketPath = EDGPIOD_SOCKET;
+    pollMs = POLL_MS;
+
+    while((opt = getopt(argc, argv, "s:p:")) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+                socketPath = optarg;
+                break;
+
+            case 'p':
+                pollMs = atoi(optarg);
+                break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(optind + 1 >= argc || argc - optind - 1 > EDGPIOD_DEVICES || pollMs < 1)
+    {
+        usage(argv[0]);
+    }
+
+    busName = argv[optind];
+
+    // Before touching the bus, so a second daemon leaves the first alone.
+    // Clients are only accepted once the devices are published.
+    listenFd = listenOn(socketPath);
+    if(listenFd < 0)
+    {
+        perror("edgpiod: socket");
+        exit(1);
+    }
+
+    memFd = memfd_create("edgpiod", MFD_CLOEXEC);
+    if(memFd < 0 || ftruncate(memFd, sizeof(struct edgpiodShared)) < 0)
+    {
+        perror("edgpiod: memfd");
+        exit(1);
+    }
+    shared = mmap(NULL, sizeof(struct edgpiodShared), PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+    if(shared == MAP_FAILED)
+    {
+        perror("edgpiod: mmap");
+        exit(1);
+    }
+    shared -> version = EDGPIOD_VERSION;
+    shared -> pollNs = (uint64_t)pollMs * 1000000;
+
+    for(c = 0; c < argc - optind - 1; c++)
+    {
+        address = strtol(argv[optind + 1 + c], NULL, 0);
+        devices[c] = ioOpen(busName, address, 0);
+        if(devices[c] == NULL)
+        {
+            fprintf(stderr, "edgpiod: no MCP23017 at 0x%02x on %s\n", address, busName);
+            exit(1);
+        }
+        addresses[c] = address;
+        shared -> devices[c].address = address;
+    }
+    pollDevices();
+
+    doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    arm.it_value.tv_sec = pollMs / 1000;
+    arm.it_value.tv_nsec = (pollMs % 1000) * 1000000;
+    arm.it_interval = arm.it_value;
+    timerfd_settime(timer, 0, &arm, NULL);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &ev);
+    ev.data.fd = doorbell;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, doorbell, &ev);
+    ev.data.fd = timer;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, timer, &ev);
+
+    // No SA_RESTART so epoll_wait() returns on a signal
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while(stopping == 0)
+    {
+        runQueue();
+
+        // Say we're going to sleep then look again, a client that missed
+        // the flag has already made its slot visible.  With commands
+        // waiting only look at the other descriptors.
+        __atomic_store_n(&shared -> sleeping, 1, __ATOMIC_SEQ_CST);
+        pending = __atomic_load_n(&shared -> slots[head & (EDGPIOD_QUEUE - 1)].ready, __ATOMIC_SEQ_CST);
+
+        n = epoll_wait(epfd, events, 4, pending ? 0 : -1);
+        __atomic_store_n(&shared -> sleeping, 0, __ATOMIC_SEQ_CST);
+
+        for(c = 0; c < n; c++)
+        {
+            if(events[c].data.fd == doorbell)
+            {
+                read(doorbell, &count, sizeof(count));
+            }
+            else if(events[c].data.fd == timer)
+            {
+                read(timer, &count, sizeof(count));
+                pollDevices();
+            }
+            else if(events[c].data.fd == listenFd)
+            {
+                acceptClient(listenFd, memFd, doorbell);
+            }
+        }
+    }
+
+    unlink(socketPath);
+    for(c = 0; c < EDGPIOD_DEVICES && devices[c] != NULL; c++)
+    {
+        ioClose(devices[c]);
+    }
+    i2cClose();
+
+    return 0;
+}
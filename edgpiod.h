@@ -0,0 +1,99 @@
+#ifndef __GOT_EDGPIOD
+
+#define __GOT_EDGPIOD
+
+// Shared memory between edgpiod and its clients, see edgpiod.c
+//
+// A client connects to the daemon's socket and is sent two descriptors, a
+// memfd holding struct edgpiodShared and an eventfd.  Commands go on the
+// queue the same way as i2cAsync requests: reserve a place in inFlight,
+// take a position from tail, fill the slot and set ready.  The eventfd is
+// only written if the daemon said it was sleeping.  Completed commands
+// bump done, which clients wait on with a futex.  Device state is
+// published under a seqlock, an odd seq means an update is in progress.
+//
+// A place in inFlight is given back by the client once it has read its
+// result, so no later command can reuse the result entry first.  A client
+// that gives up waiting marks the entry abandoned and the daemon gives the
+// place back when the command runs.  Anyone waiting for a place waits on
+// inFlight with a futex.
+
+// Default socket, clients also look at $EDGPIOD_SOCKET
+#define EDGPIOD_SOCKET   "/tmp/edgpiod.sock"
+
+#define EDGPIOD_VERSION  2
+#define EDGPIOD_DEVICES  8
+
+// Commands queued at once, a power of 2
+#define EDGPIOD_QUEUE    256
+
+// Commands, each sets a register pair to ((old & ~clear) | set) ^ flip
+#define EDGPIOD_OLAT     0
+#define EDGPIOD_IODIR    1
+#define EDGPIOD_GPPU     2
+#define EDGPIOD_RESET    3
+
+struct edgpiodCommand
+{
+    uint32_t op;
+    uint32_t address;
+    uint16_t clear;
+    uint16_t set;
+    uint16_t flip;
+    uint16_t reserved;
+};
+
+// ready is set by the client once the command is filled in and cleared by
+// the daemon when it has taken it
+struct edgpiodSlot
+{
+    uint32_t ready;
+    uint32_t reserved;
+    struct edgpiodCommand command;
+};
+
+// Result states
+#define EDGPIOD_WAITING    0
+#define EDGPIOD_DONE       1
+#define EDGPIOD_ABANDONED  2
+
+// Result of the command at position ticket, the entry is reused by the
+// command EDGPIOD_QUEUE positions later once the place is given back
+struct edgpiodResult
+{
+    uint64_t ticket;
+    int64_t result;
+    uint32_t state;
+    uint32_t reserved;
+};
+
+// Register images as words, port A in the low byte.  gpio is polled, the
+// others come from the daemon's register cache.
+struct edgpiodDevice
+{
+    uint32_t seq;
+    uint32_t address;           // 0 if the slot is unused
+    int32_t error;              // Last bus error polling or 0
+    uint32_t reserved;
+    uint64_t updated;           // CLOCK_MONOTONIC ns gpio was read
+    uint16_t gpio;
+    uint16_t olat;
+    uint16_t iodir;
+    uint16_t gppu;
+};
+
+struct edgpiodShared
+{
+    uint32_t version;
+    uint32_t done;              // Low 32 bits of commands completed
+    uint32_t inFlight;          // Places taken, commands queued or results unread
+    uint32_t sleeping;          // Set while the daemon waits for work
+    uint64_t tail;              // Next enqueue position
+    uint64_t head;              // Next position the daemon runs
+    uint64_t pollNs;            // How often gpio is read
+    struct edgpiodDevice devices[EDGPIOD_DEVICES];
+    struct edgpiodSlot slots[EDGPIOD_QUEUE];
+    struct edgpiodResult results[EDGPIOD_QUEUE];
+};
+
+#endif
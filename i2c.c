@@ -9,135 +9,1065 @@
 #include <sys/ioctl.h>
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 
 #define __IN_I2C
+#include "edgpio.h"
 #include "i2c.h"
 
-#define OPEN_DELAY   500
+// Default retry policy, see i2cSetRetryPolicy()
+#define RETRY_ATTEMPTS    3
+#define RETRY_BACKOFF     1000
+#define RETRY_MAX_BACKOFF 100000
+#define RETRY_DEADLINE    0
 
-static char *i2cFileName;
-static uint8_t buf[10];
-static int openRetries;
+// Number of buses that can be held open at once
+#define MAX_BUSES    4
 
-void i2cFatal()
+// Slave address value meaning "I2C_SLAVE not yet issued on this fd"
+#define NO_SLAVE     -1
+
+// Longest transfer i2c-dev does as one transaction
+#define I2C_DEV_MAX  8192
+
+// Bulk transfers are split into chunks of this many bytes by default, and
+// at most BULK_CHUNK_MAX
+#define BULK_CHUNK     8
+#define BULK_CHUNK_MAX I2C_SMBUS_BLOCK_MAX
+
+// A transfer waiting for the bus, on the waiting thread's stack
+struct i2cWaiter
+{
+    struct i2cWaiter *next;
+    int cls;
+    int64_t deadline;
+    int granted;
+};
+
+// One cached handle per bus device.  The device is opened on first use and
+// kept open; I2C_SLAVE is only reissued when the target address changes.
+// transport does the transfers, see i2cSetTransport().  One transfer with
+// its retries holds the bus at a time, the rest wait in waiters and are
+// let on by priority class then deadline, see i2cBusAcquire().
+struct i2cBus
+{
+    char *fileName;
+    int fd;
+    int slaveAddr;
+    struct i2cTransport *transport;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int busy;
+    struct i2cWaiter *waiters;
+};
+
+static struct i2cBus i2cBuses[MAX_BUSES];
+static struct i2cBus *i2cCurrentBus;
+static struct i2cStats stats;
+
+static struct i2cRetryPolicy policy =
+{
+    RETRY_ATTEMPTS, RETRY_BACKOFF, RETRY_MAX_BACKOFF, RETRY_DEADLINE
+};
+
+// Scheduling, see i2cSetPriority().  addressClasses holds class + 1, 0 for
+// the default: MCP23017 addresses realtime, anything else normal.
+static uint8_t addressClasses[128];
+static int bulkChunk = BULK_CHUNK;
+static __thread int threadClass = I2C_CLASS_AUTO;
+static __thread int threadDeadline;
+static __thread int bulkFlags;
+
+static struct i2cTransport i2cAutoTransport;
+static struct i2cTransport i2cRdwrTransport;
+static struct i2cTransport i2cReadWriteTransport;
+static struct i2cTransport i2cSmbusTransport;
+
+// Indexed by I2C_TRANSPORT_XXXX
+static struct i2cTransport *transports[] =
 {
-    printf("** I2C Fatal error on %s!!\n", i2cFileName);
-    perror("i2c");
-    exit(1);
+    &i2cAutoTransport,
+    &i2cRdwrTransport,
+    &i2cReadWriteTransport,
+    &i2cSmbusTransport,
+    &i2cSimTransport
+};
+
+struct i2cBus *i2cOpenBus(char *busDeviceName)
+{
+    int c;
+    struct i2cBus *freeBus;
+    pthread_condattr_t attr;
+
+    freeBus = NULL;
+    for(c = 0; c < MAX_BUSES; c++)
+    {
+        if(i2cBuses[c].fileName == NULL)
+        {
+            if(freeBus == NULL)
+            {
+                freeBus = &i2cBuses[c];
+            }
+        }
+        else
+        {
+            if(strcmp(i2cBuses[c].fileName, busDeviceName) == 0)
+            {
+                return &i2cBuses[c];
+            }
+        }
+    }
+
+    if(freeBus == NULL)
+    {
+        return NULL;
+    }
+
+    freeBus -> fileName = malloc(strlen(busDeviceName) + 1);
+    strcpy(freeBus -> fileName, busDeviceName);
+    freeBus -> fd = -1;
+    freeBus -> slaveAddr = NO_SLAVE;
+    freeBus -> transport = &i2cAutoTransport;
+    pthread_mutex_init(&freeBus -> lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&freeBus -> wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return freeBus;
 }
 
 void i2cInit(char *busDeviceName, int rdBuffSize, int wrBuffSize, int retries)
 {
-    i2cFileName = malloc(strlen(busDeviceName) + 1);
-    strcpy(i2cFileName, busDeviceName);
+    i2cCurrentBus = i2cOpenBus(busDeviceName);
 
+    free(i2cReadBuffer);
+    free(i2cWriteBuffer);
     i2cReadBuffer = malloc(rdBuffSize);
     i2cWriteBuffer = malloc(wrBuffSize);
 
-    openRetries = retries;
+    policy.attempts = retries > 0 ? retries : 1;
+}
+
+void i2cSetRetryPolicy(struct i2cRetryPolicy *newPolicy)
+{
+    policy = *newPolicy;
+    if(policy.attempts < 1)
+    {
+        policy.attempts = 1;
+    }
+}
+
+void i2cGetRetryPolicy(struct i2cRetryPolicy *copy)
+{
+    *copy = policy;
+}
+
+static int64_t i2cNow()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Whether waiter a goes on the bus before b: lower class first, then the
+// earlier deadline, no deadline last.  Ties keep arrival order.
+static int i2cWaiterBefore(struct i2cWaiter *a, struct i2cWaiter *b)
+{
+    if(a -> cls != b -> cls)
+    {
+        return a -> cls < b -> cls;
+    }
+
+    return a -> deadline != 0 && (b -> deadline == 0 || a -> deadline < b -> deadline);
+}
+
+// Wait for the bus.  deadline is an i2cNow() time, 0 for none.
+// Returns 0 holding the bus, or -ETIMEDOUT if the deadline passed first.
+static int i2cBusAcquire(struct i2cBus *bus, int cls, int64_t deadline)
+{
+    struct i2cWaiter waiter;
+    struct i2cWaiter **w;
+    struct timespec until;
+    int64_t start;
+    int status;
+
+    start = i2cPerfNow();
+    status = 0;
+
+    pthread_mutex_lock(&bus -> lock);
+    if(bus -> busy == 0)
+    {
+        bus -> busy = 1;
+    }
+    else
+    {
+        waiter.next = NULL;
+        waiter.cls = cls;
+        waiter.deadline = deadline;
+        waiter.granted = 0;
+        for(w = &bus -> waiters; *w != NULL; w = &(*w) -> next)
+        {
+        }
+        *w = &waiter;
+
+        until.tv_sec = deadline / 1000000;
+        until.tv_nsec = (deadline % 1000000) * 1000;
+        while(waiter.granted == 0)
+        {
+            if(deadline == 0)
+            {
+                pthread_cond_wait(&bus -> wake, &bus -> lock);
+            }
+            else if(pthread_cond_timedwait(&bus -> wake, &bus -> lock, &until) == ETIMEDOUT && waiter.granted == 0)
+            {
+                for(w = &bus -> waiters; *w != &waiter; w = &(*w) -> next)
+                {
+                }
+                *w = waiter.next;
+                status = -ETIMEDOUT;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&bus -> lock);
+
+    i2cPerfTime(I2C_PERF_WAIT + cls, i2cPerfNow() - start);
+    if(status < 0)
+    {
+        i2cPerfMissed(cls);
+    }
+
+    return status;
+}
+
+// Hand the bus to the first waiter, or free it
+static void i2cBusRelease(struct i2cBus *bus)
+{
+    struct i2cWaiter **best;
+    struct i2cWaiter **w;
+    struct i2cWaiter *next;
+
+    pthread_mutex_lock(&bus -> lock);
+    best = NULL;
+    for(w = &bus -> waiters; *w != NULL; w = &(*w) -> next)
+    {
+        if(best == NULL || i2cWaiterBefore(*w, *best))
+        {
+            best = w;
+        }
+    }
+
+    if(best == NULL)
+    {
+        bus -> busy = 0;
+    }
+    else
+    {
+        next = *best;
+        *best = next -> next;
+        next -> granted = 1;
+        pthread_cond_broadcast(&bus -> wake);
+    }
+    pthread_mutex_unlock(&bus -> lock);
+}
+
+static void i2cBusClose(struct i2cBus *bus)
+{
+    // Unused slots are all zero
+    if(bus -> fileName == NULL)
+    {
+        return;
+    }
+
+    if(bus -> fd >= 0)
+    {
+        bus -> transport -> close(bus);
+    }
+
+    bus -> fd = -1;
+    bus -> slaveAddr = NO_SLAVE;
+}
+
+void i2cClose()
+{
+    int c;
+
+    for(c = 0; c < MAX_BUSES; c++)
+    {
+        if(i2cBuses[c].fileName != NULL)
+        {
+            i2cBusAcquire(&i2cBuses[c], I2C_CLASS_NORMAL, 0);
+            i2cBusClose(&i2cBuses[c]);
+            i2cBusRelease(&i2cBuses[c]);
+        }
+    }
+}
+
+int i2cSetTransport(char *busDeviceName, int transport)
+{
+    struct i2cBus *bus;
+
+    bus = i2cOpenBus(busDeviceName);
+    if(bus == NULL || transport < I2C_TRANSPORT_AUTO || transport > I2C_TRANSPORT_SIM)
+    {
+        return -1;
+    }
+
+    i2cBusAcquire(bus, I2C_CLASS_NORMAL, 0);
+    i2cBusClose(bus);
+    bus -> transport = transports[transport];
+    i2cBusRelease(bus);
+
+    return 0;
+}
+
+char *i2cGetTransport(char *busDeviceName)
+{
+    struct i2cBus *bus;
+
+    bus = i2cOpenBus(busDeviceName);
+    if(bus == NULL)
+    {
+        return NULL;
+    }
+
+    return bus -> transport -> name;
+}
+
+// NULL selects the bus given to i2cInit()
+static struct i2cBus *i2cBusSelect(struct i2cBus *bus)
+{
+    if(bus == I2C_DEFAULT_BUS)
+    {
+        return i2cCurrentBus;
+    }
+
+    return bus;
+}
+
+static int i2cBusGet(struct i2cBus *bus)
+{
+    if(bus -> fd < 0)
+    {
+        bus -> fd = bus -> transport -> open(bus);
+    }
+
+    return bus -> fd;
+}
+
+int i2cMaxTransfer(struct i2cBus *bus)
+{
+    int max;
+
+    bus = i2cBusSelect(bus);
+    if(bus == NULL)
+    {
+        return I2C_SMBUS_BLOCK_MAX;
+    }
+
+    // Auto only knows once the adapter has been asked
+    i2cBusAcquire(bus, I2C_CLASS_NORMAL, 0);
+    i2cBusGet(bus);
+    max = bus -> transport -> maxTransfer;
+    i2cBusRelease(bus);
+
+    return max;
+}
+
+/*=================================Transports=================================*/
+
+static int i2cDevOpen(struct i2cBus *bus)
+{
+    int64_t start;
+    int fd;
+
+    start = i2cPerfNow();
+    fd = open(bus -> fileName, O_RDWR);
+    i2cPerfTime(I2C_PERF_OPEN, i2cPerfNow() - start);
+    stats.opens++;
+    if(fd < 0)
+    {
+        return -errno;
+    }
+
+    return fd;
+}
+
+static void i2cDevClose(struct i2cBus *bus)
+{
+    close(bus -> fd);
+    stats.closes++;
+}
+
+static int i2cDevSlave(struct i2cBus *bus, uint8_t slaveAddr)
+{
+    int64_t start;
+    int status;
+
+    if(bus -> slaveAddr != slaveAddr)
+    {
+        stats.ioctls++;
+        start = i2cPerfNow();
+        status = ioctl(bus -> fd, I2C_SLAVE, slaveAddr);
+        i2cPerfTime(I2C_PERF_IOCTL, i2cPerfNow() - start);
+        if(status < 0)
+        {
+            return -errno;
+        }
+        bus -> slaveAddr = slaveAddr;
+    }
+
+    return 0;
+}
+
+// Pick a transport from what the adapter says it can do: I2C_RDWR if it
+// can do plain I2C, SMBus block transfers if it can do those, read() and
+// write() otherwise.  The bus keeps the one picked.
+static int i2cAutoOpen(struct i2cBus *bus)
+{
+    unsigned long funcs;
+    int64_t start;
+    int status;
+    int fd;
+
+    if(strcmp(bus -> fileName, I2C_SIM_BUS) == 0)
+    {
+        bus -> transport = &i2cSimTransport;
+        return bus -> transport -> open(bus);
+    }
+
+    fd = i2cDevOpen(bus);
+    if(fd < 0)
+    {
+        return fd;
+    }
+
+    stats.ioctls++;
+    start = i2cPerfNow();
+    status = ioctl(fd, I2C_FUNCS, &funcs);
+    i2cPerfTime(I2C_PERF_IOCTL, i2cPerfNow() - start);
+    if(status < 0)
+    {
+        funcs = 0;
+    }
+
+    if(funcs & I2C_FUNC_I2C)
+    {
+        bus -> transport = &i2cRdwrTransport;
+    }
+    else if((funcs & I2C_FUNC_SMBUS_I2C_BLOCK) == I2C_FUNC_SMBUS_I2C_BLOCK)
+    {
+        bus -> transport = &i2cSmbusTransport;
+    }
+    else
+    {
+        bus -> transport = &i2cReadWriteTransport;
+    }
+
+    return fd;
+}
+
+static int i2cRdwr(struct i2cBus *bus, struct i2c_msg *msgs, int count)
+{
+    struct i2c_rdwr_ioctl_data xfer;
+
+    xfer.msgs = msgs;
+    xfer.nmsgs = count;
+
+    stats.ioctls++;
+    if(ioctl(bus -> fd, I2C_RDWR, &xfer) != count)
+    {
+        return errno ? -errno : -EIO;
+    }
+
+    return 0;
+}
+
+// Write the register pointer then read back length bytes as one I2C_RDWR
+// transaction with a repeated start, so nothing can move the pointer between
+// the two and it only costs one system call
+static int i2cRdwrRead(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *data, int length)
+{
+    struct i2c_msg msgs[2];
+
+    msgs[0].addr = address;
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = &reg;
+
+    msgs[1].addr = address;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = length;
+    msgs[1].buf = data;
+
+    return i2cRdwr(bus, msgs, 2);
+}
+
+// No I2C_SLAVE needed, the address goes with the message
+static int i2cRdwrWrite(struct i2cBus *bus, uint8_t address, uint8_t *data, int length)
+{
+    struct i2c_msg msg;
+
+    msg.addr = address;
+    msg.flags = 0;
+    msg.len = length;
+    msg.buf = data;
+
+    return i2cRdwr(bus, &msg, 1);
 }
 
-int i2cBusOpen(uint8_t slaveAddr)
+// write() and read() report short transfers as -EIO
+static int i2cFdWrite(int fd, uint8_t *data, int length)
 {
-    int busFd;
-    int tries;
+    ssize_t done;
 
-    busFd = -1;
-    tries = 1;
-    while(busFd < 0 && tries < openRetries)
+    stats.writes++;
+    done = write(fd, data, length);
+    if(done < 0)
     {
-        busFd= open(i2cFileName, O_RDWR);
-        if(busFd < 0)
+        return -errno;
+    }
+
+    return done == length ? 0 : -EIO;
+}
+
+static int i2cFdRead(int fd, uint8_t *data, int length)
+{
+    ssize_t done;
+
+    stats.reads++;
+    done = read(fd, data, length);
+    if(done < 0)
+    {
+        return -errno;
+    }
+
+    return done == length ? 0 : -EIO;
+}
+
+// Separate write of the register pointer and read, for adapters without
+// I2C_RDWR.  Another master could move the pointer in between.
+static int i2cReadWriteRead(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *data, int length)
+{
+    int status;
+
+    status = i2cDevSlave(bus, address);
+    if(status == 0)
+    {
+        status = i2cFdWrite(bus -> fd, &reg, 1);
+    }
+    if(status == 0)
+    {
+        status = i2cFdRead(bus -> fd, data, length);
+    }
+
+    return status;
+}
+
+static int i2cReadWriteWrite(struct i2cBus *bus, uint8_t address, uint8_t *data, int length)
+{
+    int status;
+
+    status = i2cDevSlave(bus, address);
+    if(status == 0)
+    {
+        status = i2cFdWrite(bus -> fd, data, length);
+    }
+
+    return status;
+}
+
+static int i2cSmbus(struct i2cBus *bus, char readWrite, uint8_t command, int size, union i2c_smbus_data *data)
+{
+    struct i2c_smbus_ioctl_data args;
+
+    args.read_write = readWrite;
+    args.command = command;
+    args.size = size;
+    args.data = data;
+
+    stats.ioctls++;
+    if(ioctl(bus -> fd, I2C_SMBUS, &args) < 0)
+    {
+        return -errno;
+    }
+
+    return 0;
+}
+
+static int i2cSmbusReadReg(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *value)
+{
+    union i2c_smbus_data data;
+    int status;
+
+    status = i2cDevSlave(bus, address);
+    if(status == 0)
+    {
+        status = i2cSmbus(bus, I2C_SMBUS_READ, reg, I2C_SMBUS_BYTE_DATA, &data);
+    }
+    if(status == 0)
+    {
+        *value = data.byte;
+    }
+
+    return status;
+}
+
+// SMBus moves at most 32 bytes per transaction.  Longer transfers are split
+// into transactions at increasing register addresses, which suits chips in
+// sequential mode.  Byte mode callers keep to i2cMaxTransfer() instead.
+static int i2cSmbusRead(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *data, int length)
+{
+    union i2c_smbus_data block;
+    int status;
+    int chunk;
+    int done;
+
+    if(length == 1)
+    {
+        return i2cSmbusReadReg(bus, address, reg, data);
+    }
+
+    status = i2cDevSlave(bus, address);
+    for(done = 0; done < length && status == 0; done += chunk)
+    {
+        chunk = length - done;
+        if(chunk > I2C_SMBUS_BLOCK_MAX)
+        {
+            chunk = I2C_SMBUS_BLOCK_MAX;
+        }
+
+        block.block[0] = chunk;
+        status = i2cSmbus(bus, I2C_SMBUS_READ, reg + done, I2C_SMBUS_I2C_BLOCK_DATA, &block);
+        if(status == 0 && block.block[0] != chunk)
+        {
+            status = -EIO;
+        }
+        if(status == 0)
         {
-            usleep(OPEN_DELAY * 1000);
-            tries++;
+            memcpy(&data[done], &block.block[1], chunk);
         }
     }
 
-    if(busFd < 0)
+    return status;
+}
+
+static int i2cSmbusWrite(struct i2cBus *bus, uint8_t address, uint8_t *data, int length)
+{
+    union i2c_smbus_data block;
+    int status;
+    int chunk;
+    int done;
+
+    status = i2cDevSlave(bus, address);
+    if(status < 0)
+    {
+        return status;
+    }
+
+    // Just the register pointer
+    if(length == 1)
+    {
+        return i2cSmbus(bus, I2C_SMBUS_WRITE, data[0], I2C_SMBUS_BYTE, NULL);
+    }
+
+    if(length == 2)
+    {
+        block.byte = data[1];
+        return i2cSmbus(bus, I2C_SMBUS_WRITE, data[0], I2C_SMBUS_BYTE_DATA, &block);
+    }
+
+    for(done = 0; done < length - 1 && status == 0; done += chunk)
+    {
+        chunk = length - 1 - done;
+        if(chunk > I2C_SMBUS_BLOCK_MAX)
+        {
+            chunk = I2C_SMBUS_BLOCK_MAX;
+        }
+
+        block.block[0] = chunk;
+        memcpy(&block.block[1], &data[1 + done], chunk);
+        status = i2cSmbus(bus, I2C_SMBUS_WRITE, data[0] + done, I2C_SMBUS_I2C_BLOCK_DATA, &block);
+    }
+
+    return status;
+}
+
+// Picks one of the others when the bus is opened, see i2cAutoOpen()
+static struct i2cTransport i2cAutoTransport =
+{
+    "auto", I2C_SMBUS_BLOCK_MAX, i2cAutoOpen, i2cDevClose, NULL, NULL, NULL
+};
+
+static struct i2cTransport i2cRdwrTransport =
+{
+    "rdwr", I2C_DEV_MAX, i2cDevOpen, i2cDevClose, NULL, i2cRdwrRead, i2cRdwrWrite
+};
+
+static struct i2cTransport i2cReadWriteTransport =
+{
+    "readwrite", I2C_DEV_MAX, i2cDevOpen, i2cDevClose, NULL, i2cReadWriteRead, i2cReadWriteWrite
+};
+
+static struct i2cTransport i2cSmbusTransport =
+{
+    "smbus", I2C_SMBUS_BLOCK_MAX, i2cDevOpen, i2cDevClose, i2cSmbusReadReg, i2cSmbusRead, i2cSmbusWrite
+};
+
+/*=================================Transfers==================================*/
+
+// A transfer failed with status.  Decide whether to try again under the
+// retry policy, sleeping for the backoff first.  The device is reopened
+// unless the error was just the target not answering.
+// Returns 0 to retry, or the status to give the caller.
+static int i2cBusError(struct i2cBus *bus, uint8_t address, int attempt, int64_t start, int status)
+{
+    int64_t delay;
+
+    if(status != -ENXIO && status != -EREMOTEIO && status != -EAGAIN && status != -ETIMEDOUT)
+    {
+        i2cBusClose(bus);
+    }
+
+    if(attempt + 1 >= policy.attempts)
+    {
+        stats.failures++;
+        i2cPerfError(address, 0, 0);
+        return status;
+    }
+
+    delay = (int64_t)policy.backoff << attempt;
+    if(delay > policy.maxBackoff)
+    {
+        delay = policy.maxBackoff;
+    }
+
+    if(policy.deadline > 0 && i2cNow() + delay - start >= policy.deadline)
     {
-        i2cFatal();
+        stats.failures++;
+        stats.timeouts++;
+        i2cPerfError(address, 0, 1);
+        return -ETIMEDOUT;
     }
 
-    if(ioctl(busFd, I2C_SLAVE, slaveAddr) < 0)
+    if(delay > 0)
     {
-        i2cFatal();
+        usleep(delay);
     }
+    stats.retries++;
+    i2cPerfError(address, 1, 0);
+
+    return 0;
+}
 
-    return busFd;
+int i2cReadByteData(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *value)
+{
+    return i2cReadByteArray(bus, address, reg, value, 1);
 }
 
-uint8_t i2cReadByteData(uint8_t address, uint8_t reg)
+// Class and absolute deadline for a transfer from the calling thread
+static int i2cClassOf(uint8_t address)
 {
-    int i2cbus;
+    if(threadClass != I2C_CLASS_AUTO)
+    {
+        return threadClass;
+    }
+    if(bulkFlags != 0)
+    {
+        return I2C_CLASS_BULK;
+    }
+    if(addressClasses[address & 0x7F] != 0)
+    {
+        return addressClasses[address & 0x7F] - 1;
+    }
+
+    return (address & 0xF8) == 0x20 ? I2C_CLASS_REALTIME : I2C_CLASS_NORMAL;
+}
 
-    i2cbus = i2cBusOpen(address);
+static int64_t i2cDeadline()
+{
+    return threadDeadline > 0 ? i2cNow() + threadDeadline : 0;
+}
 
-    buf[0] = reg;
-    if((write(i2cbus, buf, 1)) != 1)
+// Chunk size a transfer of class cls may be split into, 0 to send it whole.
+// Only transfers the caller marked I2C_BULK_SPLIT are split: byte mode
+// transfers to one register, and bursts that must stay one transaction,
+// go out as they are whatever their class.
+static int i2cSplitChunk(int cls)
+{
+    if(cls != I2C_CLASS_BULK || (bulkFlags & I2C_BULK_SPLIT) == 0)
     {
-        i2cFatal();
+        return 0;
     }
 
-    if(read(i2cbus, buf, 1) != 1)
+    return bulkChunk;
+}
+
+// One transfer with its retries, holding the bus throughout
+static int i2cBusRead(struct i2cBus *bus, int cls, int64_t deadline, uint8_t address, uint8_t reg, uint8_t *rdBuffer, int length)
+{
+    struct i2cTransport *transport;
+    int64_t start;
+    int64_t t;
+    int64_t end;
+    int attempt;
+    int status;
+
+    status = i2cBusAcquire(bus, cls, deadline);
+    if(status < 0)
     {
-        i2cFatal();
+        return status;
     }
 
-    close(i2cbus);
+    start = i2cNow();
+    for(attempt = 0; ; attempt++)
+    {
+        status = i2cBusGet(bus);
+        if(status >= 0)
+        {
+            transport = bus -> transport;
+            t = i2cPerfNow();
+            if(length == 1 && transport -> readReg != NULL)
+            {
+                status = transport -> readReg(bus, address, reg, rdBuffer);
+            }
+            else
+            {
+                status = transport -> read(bus, address, reg, rdBuffer, length);
+            }
+            end = i2cPerfNow();
+            i2cPerfTransfer(address, reg, 0, length, end - t, status);
+            if(__atomic_load_n(&i2cTracing, __ATOMIC_RELAXED))
+            {
+                i2cTraceRecord(address, reg, 0, length, t, end, status);
+            }
+        }
+
+        if(status >= 0)
+        {
+            status = 0;
+            break;
+        }
+
+        status = i2cBusError(bus, address, attempt, start, status);
+        if(status < 0)
+        {
+            break;
+        }
+    }
+    i2cBusRelease(bus);
 
-    return(buf[0]);
+    return status;
 }
 
-void i2cReadByteArray(uint8_t address, uint8_t reg, uint8_t *rdBuffer, uint8_t length)
+int i2cReadByteArray(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *rdBuffer, int length)
 {
-    int i2cbus;
+    int64_t deadline;
+    int chunk;
+    int done;
+    int status;
+    int cls;
 
-    i2cbus = i2cBusOpen(address);
+    bus = i2cBusSelect(bus);
+    if(bus == NULL)
+    {
+        return -ENODEV;
+    }
+
+    cls = i2cClassOf(address);
+    deadline = i2cDeadline();
 
-    buf[0] = reg;
-    if((write(i2cbus, buf, 1)) != 1)
+    // Bulk reads give way to other transfers between chunks
+    chunk = i2cSplitChunk(cls);
+    if(chunk == 0 || chunk > length)
     {
-        i2cFatal();
+        chunk = length;
     }
 
-    read(i2cbus, rdBuffer, length);
+    done = 0;
+    do
+    {
+        if(chunk > length - done)
+        {
+            chunk = length - done;
+        }
+        status = i2cBusRead(bus, cls, deadline, address, reg + done, rdBuffer + done, chunk);
+        done += chunk;
+    } while(status == 0 && done < length);
 
-    close(i2cbus);
+    return status;
 }
 
-void i2cWriteByteData(uint8_t address, uint8_t reg, uint8_t value)
+int i2cWriteByteData(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t value)
 {
-    int i2cbus;
+    uint8_t wrBuffer[2];
 
-    i2cbus = i2cBusOpen(address);
+    wrBuffer[0] = reg;
+    wrBuffer[1] = value;
 
-    buf[0] = reg;
-    buf[1] = value;
-    if((write(i2cbus, buf, 2)) != 2)
+    return i2cWriteByteArray(bus, address, wrBuffer, 2);
+}
+
+static int i2cBusWrite(struct i2cBus *bus, int cls, int64_t deadline, uint8_t address, uint8_t *wrBuffer, int length)
+{
+    int64_t start;
+    int64_t t;
+    int64_t end;
+    int attempt;
+    int status;
+
+    status = i2cBusAcquire(bus, cls, deadline);
+    if(status < 0)
     {
-        i2cFatal();
+        return status;
     }
 
-    close(i2cbus);
+    start = i2cNow();
+    for(attempt = 0; ; attempt++)
+    {
+        status = i2cBusGet(bus);
+        if(status >= 0)
+        {
+            t = i2cPerfNow();
+            status = bus -> transport -> write(bus, address, wrBuffer, length);
+            end = i2cPerfNow();
+            i2cPerfTransfer(address, wrBuffer[0], 1, length - 1, end - t, status);
+            if(__atomic_load_n(&i2cTracing, __ATOMIC_RELAXED))
+            {
+                i2cTraceRecord(address, wrBuffer[0], 1, length - 1, t, end, status);
+            }
+        }
+
+        if(status >= 0)
+        {
+            status = 0;
+            break;
+        }
+
+        status = i2cBusError(bus, address, attempt, start, status);
+        if(status < 0)
+        {
+            break;
+        }
+    }
+    i2cBusRelease(bus);
+
+    return status;
+}
+
+int i2cWriteByteArray(struct i2cBus *bus, uint8_t address, uint8_t *wrBuffer, int length)
+{
+    uint8_t chunkBuffer[BULK_CHUNK_MAX + 1];
+    int64_t deadline;
+    int split;
+    int chunk;
+    int done;
+    int status;
+    int cls;
+
+    bus = i2cBusSelect(bus);
+    if(bus == NULL)
+    {
+        return -ENODEV;
+    }
+
+    cls = i2cClassOf(address);
+    deadline = i2cDeadline();
+
+    split = i2cSplitChunk(cls);
+    if(split == 0 || length - 1 <= split)
+    {
+        return i2cBusWrite(bus, cls, deadline, address, wrBuffer, length);
+    }
+
+    // Bulk writes give way to other transfers between chunks, each chunk
+    // starts with its own register address
+    status = 0;
+    for(done = 0; status == 0 && done < length - 1; done += chunk)
+    {
+        chunk = length - 1 - done;
+        if(chunk > split)
+        {
+            chunk = split;
+        }
+        chunkBuffer[0] = wrBuffer[0] + done;
+        memcpy(&chunkBuffer[1], &wrBuffer[1 + done], chunk);
+        status = i2cBusWrite(bus, cls, deadline, address, chunkBuffer, chunk + 1);
+    }
+
+    return status;
 }
 
-void i2cWriteByteArray(uint8_t address, uint8_t *wrBuffer, uint8_t length)
+int i2cSetPriority(int cls, int deadline)
 {
-    int i2cbus;
+    if(cls < I2C_CLASS_AUTO || cls >= I2C_CLASSES || deadline < 0)
+    {
+        return -1;
+    }
 
-    i2cbus = i2cBusOpen(address);
+    threadClass = cls;
+    threadDeadline = deadline;
 
-    if((write(i2cbus, wrBuffer, length)) != length)
+    return 0;
+}
+
+int i2cSetAddressClass(uint8_t address, int cls)
+{
+    if(address > 0x7F || cls < I2C_CLASS_AUTO || cls >= I2C_CLASSES)
     {
-        i2cFatal();
+        return -1;
     }
 
-    close(i2cbus);
+    addressClasses[address] = cls + 1;
+
+    return 0;
+}
+
+void i2cSetBulkChunk(int bytes)
+{
+    if(bytes < 0)
+    {
+        bytes = 0;
+    }
+    if(bytes > BULK_CHUNK_MAX)
+    {
+        bytes = BULK_CHUNK_MAX;
+    }
+
+    bulkChunk = bytes;
+}
+
+int i2cBulkBegin(int flags)
+{
+    int saved;
+
+    saved = bulkFlags;
+    bulkFlags = I2C_BULK | flags;
+
+    return saved;
+}
+
+void i2cBulkEnd(int saved)
+{
+    bulkFlags = saved;
+}
+
+void i2cGetStats(struct i2cStats *copy)
+{
+    *copy = stats;
+}
+
+void i2cResetStats()
+{
+    memset(&stats, 0, sizeof(stats));
 }
 
 char i2cUpdateByte(char byte, char bit, char value)
@@ -3,6 +3,8 @@
 #define __GOT_I2C
 
 // I2C Bus Variables
+// Allocated by i2cInit() for callers that use them, the library itself
+// only uses buffers on the stack
 #ifdef  __IN_I2C
 
 uint8_t *i2cWriteBuffer;
@@ -10,16 +12,78 @@ uint8_t *i2cReadBuffer;
 
 #else
 
-extern uint8_t i2cWriteBuffer[];
-extern uint8_t i2cReadBuffer[];
+extern uint8_t *i2cWriteBuffer;
+extern uint8_t *i2cReadBuffer;
 
 #endif
 
-extern uint8_t i2cReadByteData(uint8_t address, uint8_t reg);
-extern void i2cWriteByteData(uint8_t address, uint8_t reg, uint8_t value);
+// Cached handle for one bus device, see i2c.c
+struct i2cBus;
 
-extern void i2cReadByteArray(uint8_t address, uint8_t reg, uint8_t *rdBuffer, uint8_t length);
-extern void i2cWriteByteArray(uint8_t address, uint8_t *wrBuffer, uint8_t length);
+// Passed as the bus to use the one given to i2cInit()
+#define I2C_DEFAULT_BUS NULL
+
+// How one kind of bus does its transfers.  read writes the register pointer
+// then reads length bytes, write sends length bytes starting with the
+// register address.  readReg may be NULL, read is used for single bytes.
+// maxTransfer is the most bytes moved in one bus transaction, longer
+// transfers are split.  open returns a descriptor, or a negative errno.
+// All return 0 or a negative errno.
+struct i2cTransport
+{
+    char *name;
+    int maxTransfer;
+    int (*open)(struct i2cBus *bus);
+    void (*close)(struct i2cBus *bus);
+    int (*readReg)(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *value);
+    int (*read)(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *data, int length);
+    int (*write)(struct i2cBus *bus, uint8_t address, uint8_t *data, int length);
+};
+
+// Simulated MCP23017s and DS1307, see i2csim.c
+extern struct i2cTransport i2cSimTransport;
+
+// Returns NULL if all bus slots are in use
+extern struct i2cBus *i2cOpenBus(char *busDeviceName);
+
+// Most bytes the bus moves in one transaction.  Byte mode transfers, where
+// the chip doesn't step the register address, must be split to this size.
+extern int i2cMaxTransfer(struct i2cBus *bus);
+
+// Transfers return 0, or a negative errno once the retry policy is used up
+extern int i2cReadByteData(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *value);
+extern int i2cWriteByteData(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t value);
+
+extern int i2cReadByteArray(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *rdBuffer, int length);
+extern int i2cWriteByteArray(struct i2cBus *bus, uint8_t address, uint8_t *wrBuffer, int length);
+
+// Transfers from the calling thread between these are I2C_CLASS_BULK unless
+// it set a class with i2cSetPriority().  With I2C_BULK_SPLIT they may also
+// be sent in chunks at increasing register addresses, so only use it for
+// registers that auto-increment.  i2cBulkEnd() takes what i2cBulkBegin()
+// returned, so they nest.
+#define I2C_BULK        1
+#define I2C_BULK_SPLIT  2
+
+extern int i2cBulkBegin(int flags);
+extern void i2cBulkEnd(int saved);
+
+// Performance counter hooks, see i2cperf.c.  Times are in ns from
+// i2cPerfNow(), status is the transfer result.  i2cPerfError() counts a
+// failed attempt, retry if it will be tried again, timeout if the retry
+// deadline ran out.  i2cPerfMissed() counts a transfer of class cls given
+// up waiting for the bus.
+extern int64_t i2cPerfNow();
+extern void i2cPerfTime(int which, int64_t ns);
+extern void i2cPerfTransfer(uint8_t address, uint8_t reg, int write, int length, int64_t ns, int status);
+extern void i2cPerfError(uint8_t address, int retry, int timeout);
+extern void i2cPerfCached(uint8_t address, uint8_t reg);
+extern void i2cPerfMissed(int cls);
+
+// Transfer tracing, see i2ctrace.c.  Callers test i2cTracing first so
+// tracing costs one load when it's off.
+extern int i2cTracing;
+extern void i2cTraceRecord(uint8_t address, uint8_t reg, int write, int length, int64_t start, int64_t end, int status);
 
 extern char i2cUpdateByte(char byte, char bit, char value);
 extern char i2cCheckBit(char byte, char bit);
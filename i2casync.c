@@ -0,0 +1,475 @@
+/* Asynchronous requests
+ *
+ * Each i2cAsync engine has a worker thread which runs requests in the order
+ * they were submitted.  Use one engine per bus.  Requests go in through a
+ * lock-free ring that any thread can submit to, results come back either by
+ * calling the request's callback on the worker thread or through a second
+ * ring the caller drains with i2cAsyncComplete() when i2cAsyncFd() polls
+ * readable.
+ *
+ * A device used through an engine should not be used directly at the same
+ * time, the device functions are not thread safe.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "edgpio.h"
+
+// Request types
+#define REQ_READ_PIN     0
+#define REQ_WRITE_PIN    1
+#define REQ_READ_PORT    2
+#define REQ_WRITE_PORT   3
+#define REQ_READ_WORD    4
+#define REQ_WRITE_WORD   5
+#define REQ_READ_DATE    6
+#define REQ_SET_DATE     7
+#define REQ_READ_MEMORY  8
+#define REQ_WRITE_MEMORY 9
+
+struct i2cRequest
+{
+    int type;
+    ioDevice *dev;
+    uint8_t which;
+    uint16_t value;
+    struct tm *date;
+    uint8_t *data;
+    int length;
+    i2cCallback callback;
+    void *context;
+};
+
+struct i2cCompletion
+{
+    i2cCallback callback;
+    void *context;
+    int result;
+    uint32_t value;
+};
+
+// Ring slots.  ready is set by the producer once the entry is filled in
+// and cleared by the consumer when it has taken it
+struct i2cSubmitSlot
+{
+    atomic_int ready;
+    struct i2cRequest req;
+};
+
+struct i2cCompleteSlot
+{
+    atomic_int ready;
+    struct i2cCompletion done;
+};
+
+struct i2cAsync
+{
+    int depth;
+    int mode;
+
+    // Requests submitted but not yet handed back.  Submitters reserve a
+    // slot here first so neither ring can ever overflow
+    atomic_int inFlight;
+
+    struct i2cSubmitSlot *submitRing;
+    atomic_uint submitTail;
+    unsigned int submitHead;
+
+    struct i2cCompleteSlot *completeRing;
+    unsigned int completeTail;
+    unsigned int completeHead;
+
+    // Worker wakes on doorbell, callers poll completeFd
+    int doorbell;
+    int completeFd;
+    atomic_int sleeping;
+    atomic_int stop;
+
+    pthread_t worker;
+};
+
+static void asyncRing(int fd)
+{
+    uint64_t one;
+
+    one = 1;
+    write(fd, &one, sizeof(one));
+}
+
+static void asyncDrain(int fd)
+{
+    uint64_t count;
+
+    read(fd, &count, sizeof(count));
+}
+
+// Returns 0 or a negative errno, value is set for reads
+static int asyncRun(struct i2cRequest *req, uint32_t *value)
+{
+    int result;
+
+    *value = 0;
+    result = 0;
+    switch(req -> type)
+    {
+        case REQ_READ_PIN:
+            ioDevGetError(req -> dev);
+            *value = ioDevReadPin(req -> dev, req -> which);
+            result = ioDevGetError(req -> dev);
+            break;
+
+        case REQ_WRITE_PIN:
+            result = ioDevWritePin(req -> dev, req -> which, req -> value);
+            break;
+
+        case REQ_READ_PORT:
+            ioDevGetError(req -> dev);
+            *value = ioDevReadPort(req -> dev, req -> which);
+            result = ioDevGetError(req -> dev);
+            break;
+
+        case REQ_WRITE_PORT:
+            result = ioDevWritePort(req -> dev, req -> which, req -> value);
+            break;
+
+        case REQ_READ_WORD:
+            ioDevGetError(req -> dev);
+            *value = ioDevReadWord(req -> dev);
+            result = ioDevGetError(req -> dev);
+            break;
+
+        case REQ_WRITE_WORD:
+            result = ioDevWriteWord(req -> dev, req -> value);
+            break;
+
+        case REQ_READ_DATE:
+            result = rtcReadDate(req -> date);
+            break;
+
+        case REQ_SET_DATE:
+            result = rtcSetDate(req -> date);
+            break;
+
+        case REQ_READ_MEMORY:
+            result = rtcReadMemory(req -> which, req -> length, req -> data);
+            break;
+
+        case REQ_WRITE_MEMORY:
+            result = rtcWriteMemory(req -> which, req -> length, req -> data);
+            break;
+    }
+
+    return result;
+}
+
+static void asyncFinish(i2cAsync *async, struct i2cRequest *req, int result, uint32_t value)
+{
+    struct i2cCompleteSlot *slot;
+
+    if(async -> mode == I2C_ASYNC_CALLBACK)
+    {
+        if(req -> callback != NULL)
+        {
+            req -> callback(req -> context, result, value);
+        }
+        atomic_fetch_sub(&async -> inFlight, 1);
+        return;
+    }
+
+    slot = &async -> completeRing[async -> completeTail & (async -> depth - 1)];
+    slot -> done.callback = req -> callback;
+    slot -> done.context = req -> context;
+    slot -> done.result = result;
+    slot -> done.value = value;
+    atomic_store_explicit(&slot -> ready, 1, memory_order_release);
+    async -> completeTail++;
+
+    asyncRing(async -> completeFd);
+}
+
+static void *asyncWorker(void *arg)
+{
+    i2cAsync *async;
+    struct i2cSubmitSlot *slot;
+    struct i2cRequest req;
+    uint32_t value;
+    int result;
+
+    async = arg;
+    for(;;)
+    {
+        slot = &async -> submitRing[async -> submitHead & (async -> depth - 1)];
+        if(atomic_load_explicit(&slot -> ready, memory_order_acquire))
+        {
+            req = slot -> req;
+            atomic_store_explicit(&slot -> ready, 0, memory_order_relaxed);
+            async -> submitHead++;
+
+            result = asyncRun(&req, &value);
+            asyncFinish(async, &req, result, value);
+            continue;
+        }
+
+        if(atomic_load(&async -> stop))
+        {
+            break;
+        }
+
+        // Say we're going to sleep then look again, a submitter that
+        // missed the flag has already made its slot visible
+        atomic_store(&async -> sleeping, 1);
+        if(atomic_load(&slot -> ready) == 0 && atomic_load(&async -> stop) == 0)
+        {
+            asyncDrain(async -> doorbell);
+        }
+        atomic_store(&async -> sleeping, 0);
+    }
+
+    return NULL;
+}
+
+static int asyncSubmit(i2cAsync *async, struct i2cRequest *req)
+{
+    struct i2cSubmitSlot *slot;
+    unsigned int pos;
+    int n;
+
+    n = atomic_load(&async -> inFlight);
+    do
+    {
+        if(n >= async -> depth)
+        {
+            return -1;
+        }
+    } while(!atomic_compare_exchange_weak(&async -> inFlight, &n, n + 1));
+
+    pos = atomic_fetch_add(&async -> submitTail, 1);
+    slot = &async -> submitRing[pos & (async -> depth - 1)];
+    slot -> req = *req;
+    atomic_store(&slot -> ready, 1);
+
+    if(atomic_exchange(&async -> sleeping, 0))
+    {
+        asyncRing(async -> doorbell);
+    }
+
+    return 0;
+}
+
+i2cAsync *i2cAsyncOpen(int depth, int mode)
+{
+    /**
+    * Start an asynchronous request engine and its worker thread
+    * @param depth - most requests that can be in flight, rounded up to a power of 2
+    * @param mode - I2C_ASYNC_CALLBACK to call callbacks on the worker thread,
+    *               I2C_ASYNC_EVENTFD to queue them for i2cAsyncComplete()
+    * @returns - engine handle, NULL on failure
+    */
+
+    i2cAsync *async;
+    int size;
+
+    size = 1;
+    while(size < depth)
+    {
+        size = size * 2;
+    }
+
+    async = calloc(1, sizeof(i2cAsync));
+    async -> depth = size;
+    async -> mode = mode;
+    async -> submitRing = calloc(size, sizeof(struct i2cSubmitSlot));
+    async -> completeRing = calloc(size, sizeof(struct i2cCompleteSlot));
+    async -> doorbell = eventfd(0, EFD_CLOEXEC);
+    async -> completeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if(async -> doorbell < 0 || async -> completeFd < 0 ||
+       pthread_create(&async -> worker, NULL, asyncWorker, async) != 0)
+    {
+        perror("i2cAsyncOpen");
+        close(async -> doorbell);
+        close(async -> completeFd);
+        free(async -> submitRing);
+        free(async -> completeRing);
+        free(async);
+        return NULL;
+    }
+
+    return async;
+}
+
+void i2cAsyncClose(i2cAsync *async)
+{
+    /**
+    * Run any requests still queued then stop the worker thread.
+    * Completions not yet collected with i2cAsyncComplete() are run here.
+    */
+
+    atomic_store(&async -> stop, 1);
+    asyncRing(async -> doorbell);
+    pthread_join(async -> worker, NULL);
+
+    i2cAsyncComplete(async);
+
+    close(async -> doorbell);
+    close(async -> completeFd);
+    free(async -> submitRing);
+    free(async -> completeRing);
+    free(async);
+}
+
+int i2cAsyncFd(i2cAsync *async)
+{
+    /**
+    * File descriptor that polls readable when completions are waiting
+    * @returns - eventfd, only signalled in I2C_ASYNC_EVENTFD mode
+    */
+
+    return async -> completeFd;
+}
+
+int i2cAsyncComplete(i2cAsync *async)
+{
+    /**
+    * Call the callbacks of finished requests on this thread
+    * @returns - number of requests completed
+    */
+
+    struct i2cCompleteSlot *slot;
+    struct i2cCompletion done;
+    int count;
+
+    asyncDrain(async -> completeFd);
+
+    count = 0;
+    for(;;)
+    {
+        slot = &async -> completeRing[async -> completeHead & (async -> depth - 1)];
+        if(atomic_load_explicit(&slot -> ready, memory_order_acquire) == 0)
+        {
+            break;
+        }
+
+        done = slot -> done;
+        atomic_store_explicit(&slot -> ready, 0, memory_order_relaxed);
+        async -> completeHead++;
+        atomic_fetch_sub(&async -> inFlight, 1);
+
+        if(done.callback != NULL)
+        {
+            done.callback(done.context, done.result, done.value);
+        }
+        count++;
+    }
+
+    return count;
+}
+
+int ioDevReadPinAsync(i2cAsync *async, ioDevice *dev, uint8_t pin, i2cCallback callback, void *context)
+{
+    struct i2cRequest req = { REQ_READ_PIN, dev, pin, 0, NULL, NULL, 0, callback, context };
+
+    return asyncSubmit(async, &req);
+}
+
+int ioDevWritePinAsync(i2cAsync *async, ioDevice *dev, uint8_t pin, uint8_t value, i2cCallback callback, void *context)
+{
+    struct i2cRequest req = { REQ_WRITE_PIN, dev, pin, value, NULL, NULL, 0, callback, context };
+
+    return asyncSubmit(async, &req);
+}
+
+int ioDevReadPortAsync(i2cAsync *async, ioDevice *dev, uint8_t port, i2cCallback callback, void *context)
+{
+    struct i2cRequest req = { REQ_READ_PORT, dev, port, 0, NULL, NULL, 0, callback, context };
+
+    return asyncSubmit(async, &req);
+}
+
+int ioDevWritePortAsync(i2cAsync *async, ioDevice *dev, uint8_t port, uint8_t value, i2cCallback callback, void *context)
+{
+    struct i2cRequest req = { REQ_WRITE_PORT, dev, port, value, NULL, NULL, 0, callback, context };
+
+    return asyncSubmit(async, &req);
+}
+
+int ioDevReadWordAsync(i2cAsync *async, ioDevice *dev, i2cCallback callback, void *context)
+{
+    struct i2cRequest req = { REQ_READ_WORD, dev, 0, 0, NULL, NULL, 0, callback, context };
+
+    return asyncSubmit(async, &req);
+}
+
+int ioDevWriteWordAsync(i2cAsync *async, ioDevice *dev, uint16_t value, i2cCallback callback, void *context)
+{
+    struct i2cRequest req = { REQ_WRITE_WORD, dev, 0, value, NULL, NULL, 0, callback, context };
+
+    return asyncSubmit(async, &req);
+}
+
+int ioReadPinAsync(i2cAsync *async, uint8_t pin, i2cCallback callback, void *context)
+{
+    return ioDevReadPinAsync(async, ioDefaultDevice(), pin, callback, context);
+}
+
+int ioWritePinAsync(i2cAsync *async, uint8_t pin, uint8_t value, i2cCallback callback, void *context)
+{
+    return ioDevWritePinAsync(async, ioDefaultDevice(), pin, value, callback, context);
+}
+
+int ioReadPortAsync(i2cAsync *async, uint8_t port, i2cCallback callback, void *context)
+{
+    return ioDevReadPortAsync(async, ioDefaultDevice(), port, callback, context);
+}
+
+int ioWritePortAsync(i2cAsync *async, uint8_t port, uint8_t value, i2cCallback callback, void *context)
+{
+    return ioDevWritePortAsync(async, ioDefaultDevice(), port, value, callback, context);
+}
+
+int ioReadWordAsync(i2cAsync *async, i2cCallback callback, void *context)
+{
+    return ioDevReadWordAsync(async, ioDefaultDevice(), callback, context);
+}
+
+int ioWriteWordAsync(i2cAsync *async, uint16_t value, i2cCallback callback, void *context)
+{
+    return ioDevWriteWordAsync(async, ioDefaultDevice(), value, callback, context);
+}
+
+int rtcReadDateAsync(i2cAsync *async, struct tm *date, i2cCallback callback, void *context)
+{
+    struct i2cRequest req = { REQ_READ_DATE, NULL, 0, 0, date, NULL, 0, callback, context };
+
+    return asyncSubmit(async, &req);
+}
+
+int rtcSetDateAsync(i2cAsync *async, struct tm *date, i2cCallback callback, void *context)
+{
+    struct i2cRequest req = { REQ_SET_DATE, NULL, 0, 0, date, NULL, 0, callback, context };
+
+    return asyncSubmit(async, &req);
+}
+
+int rtcReadMemoryAsync(i2cAsync *async, uint8_t address, uint8_t length, uint8_t *readarray, i2cCallback callback, void *context)
+{
+    struct i2cRequest req = { REQ_READ_MEMORY, NULL, address, 0, NULL, readarray, length, callback, context };
+
+    return asyncSubmit(async, &req);
+}
+
+int rtcWriteMemoryAsync(i2cAsync *async, uint8_t address, int length, uint8_t *valuearray, i2cCallback callback, void *context)
+{
+    struct i2cRequest req = { REQ_WRITE_MEMORY, NULL, address, 0, NULL, valuearray, length, callback, context };
+
+    return asyncSubmit(async, &req);
+}
@@ -0,0 +1,254 @@
+/* Bus performance counters
+ *
+ * Counts reads, writes and bytes per device and per register, accesses
+ * served from host copies of registers, errors and retries, and keeps log2
+ * histograms of how long opens, setup ioctls and transfers take.  Updates
+ * are relaxed atomic adds so any thread can make them and nothing waits.
+ *
+ * The counters live in a struct i2cPerf, normally static.  i2cPerfShare()
+ * moves them into a POSIX shared memory segment so another process can map
+ * it read-only and watch them without stopping this one.  Fields are plain
+ * uint64_t so a reader only needs edgpio.h.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "edgpio.h"
+#include "i2c.h"
+
+// Set in a device slot's address once it is in use
+#define SLOT_USED 0x100
+
+static struct i2cPerf perfStatic = { I2C_PERF_VERSION, 0, 0, 0, { 0 }, { { 0 } }, { { 0 } } };
+static struct i2cPerf *perf = &perfStatic;
+
+static void perf_add(uint64_t *counter, uint64_t value)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+// Slot for an address, taking a free one the first time it is seen.
+// NULL once all slots are taken, the totals still count it.
+static struct i2cPerfDevice *perf_device(uint8_t address)
+{
+    struct i2cPerfDevice *dev;
+    uint64_t key;
+    uint64_t seen;
+    int c;
+
+    key = address | SLOT_USED;
+    for(c = 0; c < I2C_PERF_DEVICES; c++)
+    {
+        dev = &perf -> devices[c];
+        seen = __atomic_load_n(&dev -> address, __ATOMIC_RELAXED);
+        if(seen == 0)
+        {
+            __atomic_compare_exchange_n(&dev -> address, &seen, key, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+        if(seen == key || seen == 0)
+        {
+            return dev;
+        }
+    }
+
+    return NULL;
+}
+
+int64_t i2cPerfNow()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void i2cPerfTime(int which, int64_t ns)
+{
+    struct i2cPerfHistogram *h;
+    uint64_t max;
+    int bucket;
+
+    if(ns < 0)
+    {
+        ns = 0;
+    }
+
+    bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    if(bucket >= I2C_PERF_BUCKETS)
+    {
+        bucket = I2C_PERF_BUCKETS - 1;
+    }
+
+    h = &perf -> latency[which];
+    perf_add(&h -> count, 1);
+    perf_add(&h -> totalNs, ns);
+    perf_add(&h -> buckets[bucket], 1);
+
+    max = __atomic_load_n(&h -> maxNs, __ATOMIC_RELAXED);
+    while((uint64_t)ns > max &&
+          !__atomic_compare_exchange_n(&h -> maxNs, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+void i2cPerfTransfer(uint8_t address, uint8_t reg, int write, int length, int64_t ns, int status)
+{
+    struct i2cPerfDevice *dev;
+    struct i2cPerfReg *r;
+
+    i2cPerfTime(I2C_PERF_TRANSFER, ns);
+
+    dev = perf_device(address);
+    if(status < 0 || dev == NULL)
+    {
+        return;
+    }
+
+    r = reg < I2C_PERF_REGS ? &dev -> regs[reg] : NULL;
+    if(write)
+    {
+        perf_add(&dev -> writes, 1);
+        perf_add(&dev -> bytesWritten, length);
+        if(r != NULL)
+        {
+            perf_add(&r -> writes, 1);
+            perf_add(&r -> bytesWritten, length);
+        }
+    }
+    else
+    {
+        perf_add(&dev -> reads, 1);
+        perf_add(&dev -> bytesRead, length);
+        if(r != NULL)
+        {
+            perf_add(&r -> reads, 1);
+            perf_add(&r -> bytesRead, length);
+        }
+    }
+}
+
+void i2cPerfError(uint8_t address, int retry, int timeout)
+{
+    struct i2cPerfDevice *dev;
+
+    perf_add(&perf -> errors, 1);
+    if(retry)
+    {
+        perf_add(&perf -> retries, 1);
+    }
+    if(timeout)
+    {
+        perf_add(&perf -> timeouts, 1);
+    }
+
+    dev = perf_device(address);
+    if(dev != NULL)
+    {
+        perf_add(&dev -> errors, 1);
+        if(retry)
+        {
+            perf_add(&dev -> retries, 1);
+        }
+    }
+}
+
+void i2cPerfCached(uint8_t address, uint8_t reg)
+{
+    struct i2cPerfDevice *dev;
+
+    dev = perf_device(address);
+    if(dev != NULL)
+    {
+        perf_add(&dev -> cached, 1);
+        if(reg < I2C_PERF_REGS)
+        {
+            perf_add(&dev -> regs[reg].cached, 1);
+        }
+    }
+}
+
+void i2cPerfMissed(int cls)
+{
+    perf_add(&perf -> missed[cls], 1);
+}
+
+/*===============================Public Functions===============================*/
+
+void i2cPerfSnapshot(struct i2cPerf *copy)
+{
+    /**
+    * Copy the counters.  Each counter is read whole but the set isn't
+    * frozen, counters updated during the copy may be one call apart.
+    */
+
+    uint64_t *from;
+    uint64_t *to;
+    size_t c;
+
+    from = (uint64_t *)perf;
+    to = (uint64_t *)copy;
+    for(c = 0; c < sizeof(struct i2cPerf) / sizeof(uint64_t); c++)
+    {
+        to[c] = __atomic_load_n(&from[c], __ATOMIC_RELAXED);
+    }
+}
+
+void i2cPerfReset()
+{
+    /**
+    * Clear the counters and histograms, device slots are freed
+    */
+
+    memset(perf, 0, sizeof(struct i2cPerf));
+    perf -> version = I2C_PERF_VERSION;
+}
+
+int i2cPerfShare(char *name)
+{
+    /**
+    * Keep the counters in a shared memory segment from now on
+    * Another process can shm_open() name read only and mmap
+    * sizeof(struct i2cPerf) bytes.  The segment is left behind when the
+    * process exits so the last figures can still be read, shm_unlink() it
+    * when done.  Counts so far are carried over.
+    * @param name - segment name eg. "/edgpio"
+    * @returns - 0, or a negative errno
+    */
+
+    struct i2cPerf *shared;
+    int fd;
+
+    fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if(fd < 0)
+    {
+        return -errno;
+    }
+
+    if(ftruncate(fd, sizeof(struct i2cPerf)) < 0)
+    {
+        close(fd);
+        return -errno;
+    }
+
+    shared = mmap(NULL, sizeof(struct i2cPerf), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(shared == MAP_FAILED)
+    {
+        return -errno;
+    }
+
+    i2cPerfSnapshot(shared);
+    __atomic_store_n(&perf, shared, __ATOMIC_RELEASE);
+
+    return 0;
+}
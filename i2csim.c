@@ -0,0 +1,621 @@
+/* Simulated I2C bus
+ *
+ * A transport with no hardware behind it, selected by opening the bus
+ * I2C_SIM_BUS or with i2cSetTransport().  It holds MCP23017s at 0x20 - 0x27
+ * and a DS1307 at 0x68, anything else doesn't acknowledge.
+ *
+ * The MCP23017 model follows the data sheet register by register:
+ *  - IOCON.BANK remaps the register addresses, IOCON.SEQOP picks sequential
+ *    mode (the address pointer steps through the map and wraps) or byte
+ *    mode (it toggles between an A/B pair with BANK = 0, stays put with
+ *    BANK = 1)
+ *  - GPIO reads inputs through IPOL and outputs from OLAT, writes go to OLAT
+ *  - input changes set INTF and latch GPIO into INTCAP for enabled pins,
+ *    reading GPIO or INTCAP clears them
+ *
+ * The DS1307 has 64 bytes of registers with the pointer wrapping from 0x3F
+ * to 0x00.  Its clock runs from the host clock and the time registers are
+ * latched at the start of each read, like the chip's secondary buffer.
+ *
+ * Transactions take no time unless i2cSimSetTiming() says otherwise, so
+ * the library's own overhead can be measured apart from the bus.  Like
+ * i2c-dev, a message of more than SIM_MAX_MESSAGE bytes, register address
+ * included, fails with -EINVAL.
+ * i2cSimFail() makes transactions to a chip fail, for testing error paths.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "edgpio.h"
+#include "i2c.h"
+
+#define SIM_IOADDRESS  0x20
+#define SIM_IODEVICES  8
+#define SIM_RTCADDRESS 0x68
+
+// Longest message i2c-dev passes to an adapter
+#define SIM_MAX_MESSAGE 8192
+
+// MCP23017 registers with IOCON.BANK = 0, the model keeps them in this order
+#define IODIRA   0x00
+#define IPOLA    0x02
+#define GPINTENA 0x04
+#define DEFVALA  0x06
+#define INTCONA  0x08
+#define IOCON    0x0A
+#define IOCONB   0x0B
+#define INTFA    0x0E
+#define INTCAPA  0x10
+#define GPIOA    0x12
+#define OLATA    0x14
+#define IOREGS   0x16
+
+// IOCON bits
+#define IOCON_SEQOP  5
+#define IOCON_BANK   7
+
+// With BANK = 1 OLAT is the last register of each port, the port B
+// registers start at 0x10 and the map ends at 0x1A
+#define BANK1_OLATA  0x0A
+#define BANK1_PORTB  0x10
+#define BANK1_END    0x1B
+
+// Power on IODIR, all inputs
+#define IODIR_RESET  0xFF
+
+// DS1307 time registers and clock halt bit
+#define RTC_TIMEREGS 7
+#define RTC_CH       0x80
+
+struct simMcp
+{
+    uint8_t regs[IOREGS];
+    uint8_t inputs[2];
+    uint8_t pointer;
+};
+
+struct simRtc
+{
+    uint8_t regs[RTCMEMSIZE];
+    uint8_t pointer;
+    time_t offset;
+};
+
+static struct simMcp mcps[SIM_IODEVICES];
+static struct simRtc rtc;
+static int simByteNs = 0;
+static int simTransferNs = 0;
+static int simReady = 0;
+static uint8_t simFailAddress = 0;
+static int simFailCount = 0;
+static int simFailError = 0;
+static pthread_mutex_t simLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint8_t bcd(int dec)
+{
+    return ((dec / 10) << 4) | (dec % 10);
+}
+
+static int unbcd(uint8_t bcd)
+{
+    return (bcd >> 4) * 10 + (bcd & 0x0F);
+}
+
+static void sim_reset()
+{
+    int c;
+
+    memset(mcps, 0, sizeof(mcps));
+    for(c = 0; c < SIM_IODEVICES; c++)
+    {
+        mcps[c].regs[IODIRA] = IODIR_RESET;
+        mcps[c].regs[IODIRA + 1] = IODIR_RESET;
+    }
+
+    memset(&rtc, 0, sizeof(rtc));
+    simReady = 1;
+}
+
+// Spin rather than sleep, bus transactions are far shorter than a timer slot
+static void sim_wait(int bytes)
+{
+    struct timespec now;
+    int64_t until;
+    int64_t t;
+
+    if(simByteNs == 0 && simTransferNs == 0)
+    {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    until = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec + simTransferNs + (int64_t)bytes * simByteNs;
+    do
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        t = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    }
+    while(t < until);
+}
+
+// Error for a transaction i2cSimFail() said should fail, otherwise 0
+static int sim_fault(uint8_t address)
+{
+    if(simFailCount == 0 || address != simFailAddress)
+    {
+        return 0;
+    }
+
+    simFailCount--;
+    sim_wait(1);
+
+    return simFailError;
+}
+
+/*==================================MCP23017==================================*/
+
+static struct simMcp *mcp_find(uint8_t address)
+{
+    if(address < SIM_IOADDRESS || address >= SIM_IOADDRESS + SIM_IODEVICES)
+    {
+        return NULL;
+    }
+
+    return &mcps[address - SIM_IOADDRESS];
+}
+
+// Register for an address in the current bank, -1 if unimplemented
+static int mcp_reg(struct simMcp *mcp, uint8_t address)
+{
+    int reg;
+
+    if((mcp -> regs[IOCON] >> IOCON_BANK) & 1)
+    {
+        reg = address & 0x0F;
+        if(address >= BANK1_END || reg > BANK1_OLATA)
+        {
+            return -1;
+        }
+        return reg * 2 + (address >= BANK1_PORTB);
+    }
+
+    return address < IOREGS ? address : -1;
+}
+
+static void mcp_step(struct simMcp *mcp)
+{
+    int bank;
+
+    bank = (mcp -> regs[IOCON] >> IOCON_BANK) & 1;
+    if((mcp -> regs[IOCON] >> IOCON_SEQOP) & 1)
+    {
+        if(bank == 0)
+        {
+            mcp -> pointer ^= 1;
+        }
+        return;
+    }
+
+    mcp -> pointer++;
+    if(mcp -> pointer >= (bank ? BANK1_END : IOREGS))
+    {
+        mcp -> pointer = 0;
+    }
+}
+
+static uint8_t mcp_pins(struct simMcp *mcp, int port)
+{
+    uint8_t dir;
+
+    dir = mcp -> regs[IODIRA + port];
+
+    return (mcp -> regs[OLATA + port] & ~dir) | ((mcp -> inputs[port] ^ mcp -> regs[IPOLA + port]) & dir);
+}
+
+// Set INTF for enabled pins that changed from last, or that differ from
+// DEFVAL in compare mode.  INTCAP is only latched when INTF was clear.
+static void mcp_interrupt(struct simMcp *mcp, int port, uint8_t last)
+{
+    uint8_t pins;
+    uint8_t fired;
+    uint8_t compare;
+
+    pins = mcp_pins(mcp, port);
+    compare = mcp -> regs[INTCONA + port];
+    fired = ((pins ^ last) & ~compare) | ((pins ^ mcp -> regs[DEFVALA + port]) & compare);
+    fired &= mcp -> regs[GPINTENA + port] & mcp -> regs[IODIRA + port];
+
+    if(fired == 0)
+    {
+        return;
+    }
+
+    if(mcp -> regs[INTFA + port] == 0)
+    {
+        mcp -> regs[INTCAPA + port] = pins;
+    }
+    mcp -> regs[INTFA + port] |= fired;
+}
+
+static uint8_t mcp_read(struct simMcp *mcp, int reg)
+{
+    uint8_t value;
+    int port;
+
+    if(reg < 0)
+    {
+        return 0;
+    }
+
+    port = reg & 1;
+    if(reg == GPIOA + port)
+    {
+        value = mcp_pins(mcp, port);
+    }
+    else
+    {
+        value = mcp -> regs[reg];
+    }
+
+    // Reading GPIO or INTCAP clears the interrupt, a compare mode pin that
+    // still differs from DEFVAL fires again straight away
+    if(reg == GPIOA + port || reg == INTCAPA + port)
+    {
+        mcp -> regs[INTFA + port] = 0;
+        mcp_interrupt(mcp, port, mcp_pins(mcp, port));
+    }
+
+    return value;
+}
+
+static void mcp_write(struct simMcp *mcp, int reg, uint8_t value)
+{
+    int port;
+
+    if(reg < 0)
+    {
+        return;
+    }
+
+    port = reg & 1;
+    if(reg == IOCON || reg == IOCONB)
+    {
+        mcp -> regs[IOCON] = value;
+        mcp -> regs[IOCONB] = value;
+    }
+    else if(reg == GPIOA + port)
+    {
+        mcp -> regs[OLATA + port] = value;
+    }
+    else if(reg != INTFA + port && reg != INTCAPA + port)
+    {
+        mcp -> regs[reg] = value;
+    }
+}
+
+/*===================================DS1307===================================*/
+
+static void rtc_latch()
+{
+    struct tm date;
+    time_t now;
+
+    if(rtc.regs[0] & RTC_CH)
+    {
+        return;
+    }
+
+    now = time(NULL) + rtc.offset;
+    gmtime_r(&now, &date);
+
+    rtc.regs[0] = bcd(date.tm_sec);
+    rtc.regs[1] = bcd(date.tm_min);
+    rtc.regs[2] = bcd(date.tm_hour);
+    rtc.regs[4] = bcd(date.tm_mday);
+    rtc.regs[5] = bcd(date.tm_mon + 1);
+    rtc.regs[6] = bcd(date.tm_year % 100);
+}
+
+// The time registers were written, run the clock from the new time.
+// Day of week is left alone, its meaning is up to the user.
+static void rtc_set()
+{
+    struct tm date;
+
+    memset(&date, 0, sizeof(date));
+    date.tm_sec = unbcd(rtc.regs[0] & ~RTC_CH);
+    date.tm_min = unbcd(rtc.regs[1]);
+    date.tm_hour = unbcd(rtc.regs[2] & 0x3F);
+    date.tm_mday = unbcd(rtc.regs[4]);
+    date.tm_mon = unbcd(rtc.regs[5]) - 1;
+    date.tm_year = unbcd(rtc.regs[6]) + 100;
+
+    rtc.offset = timegm(&date) - time(NULL);
+}
+
+/*=================================Transport==================================*/
+
+static int sim_open(struct i2cBus *bus)
+{
+    (void)bus;
+
+    pthread_mutex_lock(&simLock);
+    if(simReady == 0)
+    {
+        sim_reset();
+    }
+    pthread_mutex_unlock(&simLock);
+
+    return 0;
+}
+
+static void sim_close(struct i2cBus *bus)
+{
+    (void)bus;
+}
+
+static int sim_read(struct i2cBus *bus, uint8_t address, uint8_t reg, uint8_t *data, int length)
+{
+    struct simMcp *mcp;
+    int status;
+    int c;
+
+    (void)bus;
+
+    if(length > SIM_MAX_MESSAGE)
+    {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&simLock);
+
+    status = sim_fault(address);
+    if(status < 0)
+    {
+        pthread_mutex_unlock(&simLock);
+        return status;
+    }
+
+    // Address, register, repeated start address, then the data
+    mcp = mcp_find(address);
+    if(mcp != NULL)
+    {
+        mcp -> pointer = reg;
+        for(c = 0; c < length; c++)
+        {
+            data[c] = mcp_read(mcp, mcp_reg(mcp, mcp -> pointer));
+            mcp_step(mcp);
+        }
+        sim_wait(length + 3);
+    }
+    else if(address == SIM_RTCADDRESS)
+    {
+        rtc_latch();
+        rtc.pointer = reg % RTCMEMSIZE;
+        for(c = 0; c < length; c++)
+        {
+            data[c] = rtc.regs[rtc.pointer];
+            rtc.pointer = (rtc.pointer + 1) % RTCMEMSIZE;
+        }
+        sim_wait(length + 3);
+    }
+    else
+    {
+        sim_wait(1);
+        status = -ENXIO;
+    }
+
+    pthread_mutex_unlock(&simLock);
+
+    return status;
+}
+
+static int sim_write(struct i2cBus *bus, uint8_t address, uint8_t *data, int length)
+{
+    struct simMcp *mcp;
+    int status;
+    int clock;
+    int c;
+
+    (void)bus;
+
+    if(length > SIM_MAX_MESSAGE)
+    {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&simLock);
+
+    status = sim_fault(address);
+    if(status < 0)
+    {
+        pthread_mutex_unlock(&simLock);
+        return status;
+    }
+
+    mcp = mcp_find(address);
+    if(mcp != NULL)
+    {
+        mcp -> pointer = data[0];
+        for(c = 1; c < length; c++)
+        {
+            mcp_write(mcp, mcp_reg(mcp, mcp -> pointer), data[c]);
+            mcp_step(mcp);
+        }
+        sim_wait(length + 1);
+    }
+    else if(address == SIM_RTCADDRESS)
+    {
+        clock = 0;
+        rtc.pointer = data[0] % RTCMEMSIZE;
+        for(c = 1; c < length; c++)
+        {
+            rtc.regs[rtc.pointer] = data[c];
+            clock |= rtc.pointer < RTC_TIMEREGS;
+            rtc.pointer = (rtc.pointer + 1) % RTCMEMSIZE;
+        }
+        if(clock)
+        {
+            rtc_set();
+        }
+        sim_wait(length + 1);
+    }
+    else
+    {
+        sim_wait(1);
+        status = -ENXIO;
+    }
+
+    pthread_mutex_unlock(&simLock);
+
+    return status;
+}
+
+struct i2cTransport i2cSimTransport =
+{
+    "sim", SIM_MAX_MESSAGE, sim_open, sim_close, NULL, sim_read, sim_write
+};
+
+/*===============================Public Functions===============================*/
+
+void i2cSimReset()
+{
+    /**
+    * Put every simulated chip back to its power on state
+    * MCP23017 pins are inputs, the DS1307 runs at host time
+    */
+
+    pthread_mutex_lock(&simLock);
+    sim_reset();
+    pthread_mutex_unlock(&simLock);
+}
+
+void i2cSimSetTiming(int byteNs, int transferNs)
+{
+    /**
+    * Make simulated transactions take as long as a real bus would
+    * eg. 90000 per byte at 100kHz (9 clocks per byte), 22500 at 400kHz
+    * @param byteNs - nanoseconds per byte, including address bytes
+    * @param transferNs - nanoseconds added to each transaction
+    */
+
+    simByteNs = byteNs;
+    simTransferNs = transferNs;
+}
+
+void i2cSimSetInputs(uint8_t address, uint16_t values)
+{
+    /**
+    * Drive the pins of a simulated MCP23017.  Only pins set as inputs see it.
+    * Changes on interrupt enabled pins set INTF and latch INTCAP.
+    * @param address - 0x20 to 0x27
+    * @param values - bit 0 = pin 1
+    */
+
+    struct simMcp *mcp;
+    uint8_t last[2];
+    int port;
+
+    pthread_mutex_lock(&simLock);
+    if(simReady == 0)
+    {
+        sim_reset();
+    }
+
+    mcp = mcp_find(address);
+    if(mcp != NULL)
+    {
+        for(port = 0; port < 2; port++)
+        {
+            last[port] = mcp_pins(mcp, port);
+            mcp -> inputs[port] = values >> (port * 8);
+            mcp_interrupt(mcp, port, last[port]);
+        }
+    }
+
+    pthread_mutex_unlock(&simLock);
+}
+
+uint16_t i2cSimGetOutputs(uint8_t address)
+{
+    /**
+    * Get the levels a simulated MCP23017 drives, pins set as inputs read 0
+    * @param address - 0x20 to 0x27
+    * @returns - bit 0 = pin 1
+    */
+
+    struct simMcp *mcp;
+    uint16_t outputs;
+
+    outputs = 0;
+    pthread_mutex_lock(&simLock);
+
+    mcp = mcp_find(address);
+    if(mcp != NULL)
+    {
+        outputs = (mcp -> regs[OLATA] & ~mcp -> regs[IODIRA]) |
+                  ((mcp -> regs[OLATA + 1] & ~mcp -> regs[IODIRA + 1]) << 8);
+    }
+
+    pthread_mutex_unlock(&simLock);
+
+    return outputs;
+}
+
+void i2cSimFail(uint8_t address, int count, int error)
+{
+    /**
+    * Make the next transactions to a simulated chip fail
+    * Each attempt counts, so set the retry policy to match.
+    * @param address - chip to fail
+    * @param count - number of transactions to fail, 0 to stop failing
+    * @param error - negative errno they return, eg. -EIO
+    */
+
+    pthread_mutex_lock(&simLock);
+    simFailAddress = address;
+    simFailCount = count;
+    simFailError = error;
+    pthread_mutex_unlock(&simLock);
+}
+
+int i2cSimGetRegister(uint8_t address, uint8_t reg)
+{
+    /**
+    * Look at a register of a simulated chip without a bus transaction
+    * Unlike a bus read this doesn't clear interrupts.
+    * @param reg - MCP23017 register in BANK = 0 order, or DS1307 address
+    * @returns - the value, or -1 if there is no such chip or register
+    */
+
+    struct simMcp *mcp;
+    int value;
+
+    value = -1;
+    pthread_mutex_lock(&simLock);
+    if(simReady == 0)
+    {
+        sim_reset();
+    }
+
+    mcp = mcp_find(address);
+    if(mcp != NULL && reg < IOREGS)
+    {
+        value = (reg & ~1) == GPIOA ? mcp_pins(mcp, reg & 1) : mcp -> regs[reg];
+    }
+    else if(address == SIM_RTCADDRESS && reg < RTCMEMSIZE)
+    {
+        rtc_latch();
+        value = rtc.regs[reg];
+    }
+
+    pthread_mutex_unlock(&simLock);
+
+    return value;
+}
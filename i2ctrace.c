@@ -0,0 +1,251 @@
+/* I2C transaction trace recorder
+ *
+ * While tracing is on every transfer attempt is recorded with its start and
+ * end time, device and register address, length, direction and result.
+ * Each thread writes to its own ring, allocated the first time it records,
+ * so recording takes no lock and keeps the last entries transfers for each
+ * thread.  With tracing off a transfer only tests i2cTracing.
+ *
+ * i2cTraceDump() writes every ring out as Chrome trace event JSON, which
+ * chrome://tracing and Perfetto load, or as a header and array of struct
+ * i2cTraceEvent.  Rings are kept until the process exits so the transfers
+ * of threads that have finished can still be dumped.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "edgpio.h"
+#include "i2c.h"
+
+#define TRACE_ENTRIES 4096
+
+struct traceRing
+{
+    struct traceRing *next;
+    uint32_t thread;
+    int entries;
+    uint64_t head;              // Count of events ever written
+    struct i2cTraceEvent *events;
+};
+
+int i2cTracing;
+
+static int traceEntries = TRACE_ENTRIES;
+static struct traceRing *traceRings;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct traceRing *traceRing;
+static __thread int traceFailed;
+
+// The calling thread's ring, NULL if it couldn't be allocated
+static struct traceRing *trace_ring()
+{
+    struct traceRing *ring;
+
+    if(traceRing != NULL || traceFailed)
+    {
+        return traceRing;
+    }
+
+    ring = calloc(1, sizeof(struct traceRing));
+    if(ring != NULL)
+    {
+        ring -> entries = __atomic_load_n(&traceEntries, __ATOMIC_RELAXED);
+        ring -> events = calloc(ring -> entries, sizeof(struct i2cTraceEvent));
+        if(ring -> events == NULL)
+        {
+            free(ring);
+            ring = NULL;
+        }
+    }
+
+    if(ring == NULL)
+    {
+        traceFailed = 1;
+        return NULL;
+    }
+
+    ring -> thread = syscall(SYS_gettid);
+
+    pthread_mutex_lock(&traceLock);
+    ring -> next = traceRings;
+    traceRings = ring;
+    pthread_mutex_unlock(&traceLock);
+
+    traceRing = ring;
+
+    return ring;
+}
+
+void i2cTraceRecord(uint8_t address, uint8_t reg, int write, int length, int64_t start, int64_t end, int status)
+{
+    struct i2cTraceEvent *event;
+    struct traceRing *ring;
+    uint64_t head;
+
+    ring = trace_ring();
+    if(ring == NULL)
+    {
+        return;
+    }
+
+    head = ring -> head;
+    event = &ring -> events[head % ring -> entries];
+    event -> start = start;
+    event -> end = end;
+    event -> thread = ring -> thread;
+    event -> result = status;
+    event -> length = length;
+    event -> address = address;
+    event -> reg = reg;
+    event -> write = write;
+
+    // A dump from another thread only reads up to the published head
+    __atomic_store_n(&ring -> head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Oldest event still in the ring and the count after it
+static void ring_span(struct traceRing *ring, uint64_t *first, uint64_t *count)
+{
+    uint64_t head;
+
+    head = __atomic_load_n(&ring -> head, __ATOMIC_ACQUIRE);
+    *count = head < (uint64_t)ring -> entries ? head : (uint64_t)ring -> entries;
+    *first = head - *count;
+}
+
+static void dump_json(FILE *out)
+{
+    struct i2cTraceEvent *e;
+    struct traceRing *ring;
+    uint64_t first;
+    uint64_t count;
+    uint64_t c;
+    int pid;
+    int comma;
+
+    pid = getpid();
+    comma = 0;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for(ring = traceRings; ring != NULL; ring = ring -> next)
+    {
+        ring_span(ring, &first, &count);
+        for(c = first; c < first + count; c++)
+        {
+            e = &ring -> events[c % ring -> entries];
+            fprintf(out, "%s{\"name\":\"%s 0x%02x:0x%02x\",\"cat\":\"i2c\",\"ph\":\"X\","
+                         "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+                         "\"args\":{\"addr\":%u,\"reg\":%u,\"len\":%u,\"result\":%d}}",
+                    comma ? ",\n" : "", e -> write ? "write" : "read", e -> address, e -> reg,
+                    e -> start / 1e3, (e -> end - e -> start) / 1e3, pid, e -> thread,
+                    e -> address, e -> reg, e -> length, e -> result);
+            comma = 1;
+        }
+    }
+    fprintf(out, "\n]}\n");
+}
+
+static void dump_binary(FILE *out)
+{
+    struct i2cTraceHeader header;
+    struct traceRing *ring;
+    uint64_t first;
+    uint64_t count;
+    uint64_t c;
+
+    memcpy(header.magic, I2C_TRACE_MAGIC, sizeof(header.magic));
+    header.version = I2C_TRACE_VERSION;
+    header.count = 0;
+    for(ring = traceRings; ring != NULL; ring = ring -> next)
+    {
+        ring_span(ring, &first, &count);
+        header.count += count;
+    }
+
+    // Events recorded after the count was taken are left out
+    fwrite(&header, sizeof(header), 1, out);
+    for(ring = traceRings; ring != NULL && header.count > 0; ring = ring -> next)
+    {
+        ring_span(ring, &first, &count);
+        if(count > header.count)
+        {
+            first += count - header.count;
+            count = header.count;
+        }
+        for(c = first; c < first + count; c++)
+        {
+            fwrite(&ring -> events[c % ring -> entries], sizeof(struct i2cTraceEvent), 1, out);
+        }
+        header.count -= count;
+    }
+}
+
+/*===============================Public Functions===============================*/
+
+void i2cTraceEnable(int entries)
+{
+    /**
+    * Start recording transfers
+    * @param entries - ring size for threads that haven't recorded yet,
+    *                  0 for the default of 4096
+    */
+
+    __atomic_store_n(&traceEntries, entries > 0 ? entries : TRACE_ENTRIES, __ATOMIC_RELAXED);
+    __atomic_store_n(&i2cTracing, 1, __ATOMIC_RELAXED);
+}
+
+void i2cTraceDisable()
+{
+    /**
+    * Stop recording transfers, what has been recorded is kept for dumping
+    */
+
+    __atomic_store_n(&i2cTracing, 0, __ATOMIC_RELAXED);
+}
+
+int i2cTraceDump(char *fileName, int format)
+{
+    /**
+    * Write out the recorded transfers, oldest first for each thread
+    * A thread still recording may overwrite entries as they are written,
+    * disable tracing first for an exact copy.
+    * @param fileName - file to create
+    * @param format - I2C_TRACE_JSON or I2C_TRACE_BINARY
+    * @returns - 0, or a negative errno
+    */
+
+    FILE *out;
+    int status;
+
+    out = fopen(fileName, format == I2C_TRACE_BINARY ? "wb" : "w");
+    if(out == NULL)
+    {
+        return -errno;
+    }
+
+    pthread_mutex_lock(&traceLock);
+    if(format == I2C_TRACE_BINARY)
+    {
+        dump_binary(out);
+    }
+    else
+    {
+        dump_json(out);
+    }
+    pthread_mutex_unlock(&traceLock);
+
+    status = ferror(out) ? -EIO : 0;
+    if(fclose(out) != 0 && status == 0)
+    {
+        status = -errno;
+    }
+
+    return status;
+}
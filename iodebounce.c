@@ -0,0 +1,211 @@
+/* Input debounce
+ *
+ * Filters 16 bit samples of both ports (ioReadWord(), interrupt captures or
+ * ring events) and reports only settled transitions.  All 16 pins are
+ * handled at once with vertical counters - bit n of counter plane i is bit i
+ * of pin n+1's count - so a sample costs a few dozen logic operations
+ * whatever the pin settings.
+ *
+ * Each pin has its own time constant, turned into a number of samples at
+ * the sample period given to ioDebounceOpen(), and its own filter:
+ *
+ * DEBOUNCE_COUNTER    - a pin changes once it has disagreed with its settled
+ *                       state for that many samples in a row
+ * DEBOUNCE_INTEGRATOR - disagreeing samples count up and agreeing samples
+ *                       count down, so short glitches in a long change don't
+ *                       restart it
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "edgpio.h"
+
+// Counter planes, most samples a time constant can be is 2^DEBOUNCE_BITS - 1
+#define DEBOUNCE_BITS 8
+#define DEBOUNCE_MAX  ((1 << DEBOUNCE_BITS) - 1)
+
+struct ioDebounce
+{
+    int samplePeriod;
+    uint16_t state;
+    uint16_t raw;
+    uint16_t integrator;
+    uint16_t count[DEBOUNCE_BITS];
+    uint16_t threshold[DEBOUNCE_BITS];
+};
+
+ioDebounce *ioDebounceOpen(int samplePeriod, uint16_t initial)
+{
+    /**
+    * Create a debounce filter for 16 pins
+    * Every pin starts as a counter filter that passes changes straight through
+    * @param samplePeriod - microseconds between samples
+    * @param initial - settled state to start from, bit 0 = pin 1
+    * @returns - filter handle
+    */
+
+    ioDebounce *db;
+    int pin;
+
+    db = calloc(1, sizeof(ioDebounce));
+    db -> samplePeriod = samplePeriod > 0 ? samplePeriod : 1;
+    db -> state = initial;
+    db -> raw = initial;
+
+    for(pin = 1; pin <= 16; pin++)
+    {
+        ioDebounceSetPin(db, pin, DEBOUNCE_COUNTER, 0);
+    }
+
+    return db;
+}
+
+void ioDebounceClose(ioDebounce *db)
+{
+    free(db);
+}
+
+int ioDebounceSetPin(ioDebounce *db, uint8_t pin, int mode, int time)
+{
+    /**
+    * Set the filter for a pin
+    * @param pin - 1 to 16
+    * @param mode - DEBOUNCE_COUNTER or DEBOUNCE_INTEGRATOR
+    * @param time - microseconds a change must last, 0 = no filtering
+    * @returns - 0, or -1 if pin is out of range
+    */
+
+    uint16_t bit;
+    int samples;
+    int i;
+
+    if(pin < 1 || pin > 16)
+    {
+        return -1;
+    }
+
+    samples = (time + db -> samplePeriod - 1) / db -> samplePeriod;
+    if(samples < 1)
+    {
+        samples = 1;
+    }
+    if(samples > DEBOUNCE_MAX)
+    {
+        samples = DEBOUNCE_MAX;
+    }
+
+    bit = 1 << (pin - 1);
+    for(i = 0; i < DEBOUNCE_BITS; i++)
+    {
+        db -> threshold[i] = (db -> threshold[i] & ~bit) | (((samples >> i) & 1) ? bit : 0);
+        db -> count[i] &= ~bit;
+    }
+
+    if(mode == DEBOUNCE_INTEGRATOR)
+    {
+        db -> integrator |= bit;
+    }
+    else
+    {
+        db -> integrator &= ~bit;
+    }
+
+    return 0;
+}
+
+uint16_t ioDebounceSample(ioDebounce *db, uint16_t sample)
+{
+    /**
+    * Feed a sample of all 16 pins
+    * @param sample - pin values, bit 0 = pin 1
+    * @returns - pins whose settled state changed with this sample
+    */
+
+    uint16_t differ;
+    uint16_t down;
+    uint16_t carry;
+    uint16_t match;
+    uint16_t changed;
+    uint16_t t;
+    int i;
+
+    db -> raw = sample;
+    differ = sample ^ db -> state;
+
+    // Count up every pin that disagrees with its settled state
+    carry = differ;
+    for(i = 0; i < DEBOUNCE_BITS && carry; i++)
+    {
+        t = db -> count[i] & carry;
+        db -> count[i] ^= carry;
+        carry = t;
+    }
+
+    // Agreeing counter pins start again, agreeing integrator pins
+    // count down if they are above zero
+    down = ~differ & db -> integrator;
+    t = 0;
+    for(i = 0; i < DEBOUNCE_BITS; i++)
+    {
+        t |= db -> count[i];
+        db -> count[i] &= differ | db -> integrator;
+    }
+    carry = down & t;
+    for(i = 0; i < DEBOUNCE_BITS && carry; i++)
+    {
+        t = ~db -> count[i] & carry;
+        db -> count[i] ^= carry;
+        carry = t;
+    }
+
+    // Pins whose count reached their threshold have settled
+    match = 0;
+    for(i = 0; i < DEBOUNCE_BITS; i++)
+    {
+        match |= db -> count[i] ^ db -> threshold[i];
+    }
+    changed = ~match & differ;
+
+    db -> state ^= changed;
+    for(i = 0; i < DEBOUNCE_BITS; i++)
+    {
+        db -> count[i] &= ~changed;
+    }
+
+    return changed;
+}
+
+uint16_t ioDebounceSamplePort(ioDebounce *db, uint8_t port, uint8_t value)
+{
+    /**
+    * Feed a sample of one port, the other port keeps its last sampled value
+    * Use with ioReadPort() or pin event ring entries
+    * @param port - IO_PORTA or IO_PORTB
+    * @returns - pins whose settled state changed with this sample
+    */
+
+    uint16_t sample;
+
+    if(port == IO_PORTA)
+    {
+        sample = (db -> raw & 0xFF00) | value;
+    }
+    else
+    {
+        sample = (db -> raw & 0x00FF) | (value << 8);
+    }
+
+    return ioDebounceSample(db, sample);
+}
+
+uint16_t ioDebounceState(ioDebounce *db)
+{
+    /**
+    * @returns - settled state of all 16 pins, bit 0 = pin 1
+    */
+
+    return db -> state;
+}
@@ -0,0 +1,258 @@
+/* Pin change events
+ *
+ * The MCP23017 INTA/INTB output is wired to a host GPIO line.  The line is
+ * requested from the GPIO character device with rising edge detection and
+ * waited on with epoll, so nothing is read from the bus until the chip
+ * signals a change.  On each edge INTF and INTCAP for both ports are read in
+ * one burst and the callbacks for the pins that fired are called.
+ *
+ * INTA and INTB are mirrored so either pin can be used, and IOCON_RESET sets
+ * the interrupt output active high.
+ *
+ * If the chip can't be read after an edge INT stays asserted and no further
+ * edge will come, so the read is retried by the next ioEventsWait() before
+ * it blocks.
+ *
+ * For testing the line can be a gpio-sim line driven by a simulated chip, or
+ * ioEventsOpenFd() can be given a pipe that line events are written to.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/gpio.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "edgpio.h"
+
+#define EVENT_PINS   16
+
+// Line events read per read() call
+#define EVENT_BUFFER 16
+
+struct ioPinHandler
+{
+    ioEventCallback callback;
+    void *context;
+};
+
+struct ioEvents
+{
+    ioDevice *dev;
+    int lineFd;
+    int epollFd;
+
+    // An edge whose interrupt capture hasn't been read yet
+    int pending;
+    uint64_t pendingTimestamp;
+
+    // [0] is called for every pin, [1] - [16] for that pin only
+    struct ioPinHandler handlers[EVENT_PINS + 1];
+};
+
+ioEvents *ioEventsOpen(ioDevice *dev, char *gpioChip, int lineOffset)
+{
+    /**
+    * Start waiting for interrupts from an MCP23017
+    * @param dev - device whose INTA or INTB is wired to the host
+    * @param gpioChip - host GPIO chip the line is on eg. "/dev/gpiochip0"
+    * @param lineOffset - line number on gpioChip
+    * @returns - event handle, NULL on failure
+    */
+
+    struct gpio_v2_line_request req;
+    int chipFd;
+
+    chipFd = open(gpioChip, O_RDWR | O_CLOEXEC);
+    if(chipFd < 0)
+    {
+        perror("ioEventsOpen");
+        return NULL;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = lineOffset;
+    req.num_lines = 1;
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING;
+    strncpy(req.consumer, "edgpio", sizeof(req.consumer) - 1);
+
+    if(ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req) < 0)
+    {
+        perror("ioEventsOpen");
+        close(chipFd);
+        return NULL;
+    }
+    close(chipFd);
+
+    return ioEventsOpenFd(dev, req.fd);
+}
+
+ioEvents *ioEventsOpenFd(ioDevice *dev, int lineFd)
+{
+    /**
+    * Start waiting for interrupts on a line the caller has requested
+    * @param dev - device whose INTA or INTB is wired to the host
+    * @param lineFd - line request with rising edge detection, read gives
+    *                 struct gpio_v2_line_event.  Closed by ioEventsClose(),
+    *                 or here on failure.
+    * @returns - event handle, NULL on failure
+    */
+
+    struct epoll_event ev;
+    ioEvents *events;
+    uint16_t flags;
+    uint16_t capture;
+
+    events = calloc(1, sizeof(ioEvents));
+    if(events == NULL)
+    {
+        close(lineFd);
+        return NULL;
+    }
+    events -> dev = dev;
+    events -> lineFd = lineFd;
+    events -> epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    ev.events = EPOLLIN;
+    ev.data.fd = events -> lineFd;
+    if(events -> epollFd < 0 || epoll_ctl(events -> epollFd, EPOLL_CTL_ADD, events -> lineFd, &ev) < 0)
+    {
+        perror("ioEventsOpen");
+        ioEventsClose(events);
+        return NULL;
+    }
+
+    // Either INT pin carries both ports, then clear anything already
+    // pending so the line goes inactive and the next change is an edge
+    if(ioDevSetInterruptMirror(dev, ENABLED) < 0 || ioDevReadInterrupts(dev, &flags, &capture) < 0)
+    {
+        ioEventsClose(events);
+        return NULL;
+    }
+
+    return events;
+}
+
+void ioEventsClose(ioEvents *events)
+{
+    /**
+    * Release the GPIO line and free the handle
+    */
+
+    if(events -> epollFd >= 0)
+    {
+        close(events -> epollFd);
+    }
+    close(events -> lineFd);
+    free(events);
+}
+
+int ioEventsFd(ioEvents *events)
+{
+    /**
+    * File descriptor that polls readable when an interrupt is waiting.
+    * Add it to an application's own epoll or poll set and call
+    * ioEventsWait(events, 0) when it is ready, and after ioEventsWait()
+    * returns a bus error, which leaves the interrupt to be read again.
+    */
+
+    return events -> epollFd;
+}
+
+int ioEventsOnPin(ioEvents *events, uint8_t pin, ioEventCallback callback, void *context)
+{
+    /**
+    * Set the function called when a pin causes an interrupt
+    * Interrupts for the pin must be enabled with ioSetInterruptOnPin()
+    * @param pin - 1 to 16, or 0 for every pin without its own callback
+    * @param callback - function to call, NULL to remove
+    * @returns - 0, or -1 if pin is out of range
+    */
+
+    if(pin > EVENT_PINS)
+    {
+        return -1;
+    }
+
+    events -> handlers[pin].callback = callback;
+    events -> handlers[pin].context = context;
+
+    return 0;
+}
+
+int ioEventsWait(ioEvents *events, int timeout)
+{
+    /**
+    * Wait for an interrupt and call the callbacks for the pins that caused it
+    * @param timeout - milliseconds to wait, 0 to only check, -1 for ever
+    * @returns - number of pin events delivered, 0 on timeout, -1 on error or
+    *            a negative errno if the chip couldn't be read.  The read is
+    *            tried again by the next call, before it waits.
+    */
+
+    struct gpio_v2_line_event lineEvents[EVENT_BUFFER];
+    struct epoll_event ev;
+    struct ioPinHandler *handler;
+    uint64_t timestamp;
+    uint16_t flags;
+    uint16_t capture;
+    ssize_t len;
+    int count;
+    int bit;
+
+    if(events -> pending == 0)
+    {
+        count = epoll_wait(events -> epollFd, &ev, 1, timeout);
+        if(count <= 0)
+        {
+            return (count < 0 && errno != EINTR) ? -1 : 0;
+        }
+
+        len = read(events -> lineFd, lineEvents, sizeof(lineEvents));
+        if(len < (ssize_t)sizeof(struct gpio_v2_line_event))
+        {
+            return -1;
+        }
+
+        // Several edges may have queued, one read of the chip covers them all
+        events -> pendingTimestamp = lineEvents[len / sizeof(struct gpio_v2_line_event) - 1].timestamp_ns;
+        events -> pending = 1;
+    }
+    timestamp = events -> pendingTimestamp;
+
+    // Until this succeeds INT stays asserted and the line won't see an edge
+    count = ioDevReadInterrupts(events -> dev, &flags, &capture);
+    if(count < 0)
+    {
+        return count;
+    }
+    events -> pending = 0;
+
+    count = 0;
+    for(bit = 0; bit < EVENT_PINS; bit++)
+    {
+        if(flags & (1 << bit))
+        {
+            handler = &events -> handlers[bit + 1];
+            if(handler -> callback == NULL)
+            {
+                handler = &events -> handlers[0];
+            }
+
+            if(handler -> callback != NULL)
+            {
+                handler -> callback(handler -> context, events -> dev, bit + 1,
+                                    (capture >> bit) & 1, timestamp);
+            }
+            count++;
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,194 @@
+/* Input poller
+ *
+ * A thread samples the inputs of one device at a fixed rate and publishes
+ * each sample under a seqlock.  Any number of threads can then read the
+ * inputs with a few loads and no lock: the device's ioDevReadPin(),
+ * ioDevReadPort() and ioDevReadWord() use the latest sample while the
+ * poller is attached, and ioPollerRead() gives it with its age.
+ *
+ * Samples are taken on an absolute CLOCK_MONOTONIC schedule so the rate
+ * doesn't drift with the time each read takes.  If a read fails the last
+ * good inputs stay published along with the error.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "edgpio.h"
+
+struct ioPoller
+{
+    ioDevice *dev;
+    int period;
+    int flags;
+    int stop;
+    pthread_t thread;
+
+    // Published sample, seq is odd while it changes
+    uint32_t seq;
+    uint16_t gpio;
+    uint16_t intFlags;
+    uint16_t capture;
+    int error;
+    uint64_t timestamp;
+    uint64_t samples;
+};
+
+static uint64_t pollNow()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Take a sample and publish it, only this thread writes the fields
+static void pollSample(ioPoller *poller)
+{
+    uint16_t gpio;
+    uint16_t flags;
+    uint16_t capture;
+    uint64_t timestamp;
+    int status;
+
+    flags = 0;
+    capture = 0;
+    if(poller -> flags & IO_POLL_INTERRUPTS)
+    {
+        status = ioDevSampleInputs(poller -> dev, &gpio, &flags, &capture);
+    }
+    else
+    {
+        status = ioDevSampleInputs(poller -> dev, &gpio, NULL, NULL);
+    }
+    timestamp = pollNow();
+
+    __atomic_store_n(&poller -> seq, poller -> seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if(status == 0)
+    {
+        __atomic_store_n(&poller -> gpio, gpio, __ATOMIC_RELAXED);
+        __atomic_store_n(&poller -> intFlags, flags, __ATOMIC_RELAXED);
+        __atomic_store_n(&poller -> capture, capture, __ATOMIC_RELAXED);
+        __atomic_store_n(&poller -> timestamp, timestamp, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&poller -> error, status, __ATOMIC_RELAXED);
+    __atomic_store_n(&poller -> samples, poller -> samples + 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&poller -> seq, poller -> seq + 1, __ATOMIC_RELEASE);
+}
+
+static void *pollThread(void *arg)
+{
+    ioPoller *poller;
+    struct timespec next;
+
+    poller = arg;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while(__atomic_load_n(&poller -> stop, __ATOMIC_RELAXED) == 0)
+    {
+        next.tv_nsec += (long)poller -> period * 1000;
+        while(next.tv_nsec >= 1000000000)
+        {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        pollSample(poller);
+    }
+
+    return NULL;
+}
+
+/*===============================Public Functions===============================*/
+
+ioPoller *ioPollerOpen(ioDevice *dev, int period, int flags)
+{
+    /**
+    * Start a thread sampling the inputs of dev and serve its GPIO reads from it
+    * The first sample is taken before returning.  Other threads can go on
+    * using the device, the bus is locked for each transfer.
+    * @param period - time between samples in us
+    * @param flags - 0, or IO_POLL_INTERRUPTS to read INTF and INTCAP with
+    *                GPIO, which acknowledges interrupts
+    * @returns - poller handle, NULL if the first sample fails
+    */
+
+    ioPoller *poller;
+
+    if(period < 1)
+    {
+        return NULL;
+    }
+
+    poller = calloc(1, sizeof(ioPoller));
+    poller -> dev = dev;
+    poller -> period = period;
+    poller -> flags = flags;
+
+    pollSample(poller);
+    if(poller -> error < 0 || pthread_create(&poller -> thread, NULL, pollThread, poller) != 0)
+    {
+        free(poller);
+        return NULL;
+    }
+
+    ioDevSetPoller(dev, poller);
+
+    return poller;
+}
+
+void ioPollerClose(ioPoller *poller)
+{
+    /**
+    * Stop the thread, the device reads the bus again
+    * Device reads in other threads move to the bus and any still using the
+    * poller are waited for, but ioPollerRead() on this handle must be done.
+    */
+
+    // After this no device read can reach the poller
+    ioDevSetPoller(poller -> dev, NULL);
+
+    __atomic_store_n(&poller -> stop, 1, __ATOMIC_RELAXED);
+    pthread_join(poller -> thread, NULL);
+
+    free(poller);
+}
+
+int ioPollerRead(ioPoller *poller, struct ioInputSnapshot *snapshot)
+{
+    /**
+    * Get the latest sample without touching the bus
+    * @param snapshot - set to the sample and its age
+    * @returns - 0, or the negative errno of the last sample.  The inputs are
+    *            then from the last good one.
+    */
+
+    uint32_t seq;
+
+    do
+    {
+        seq = __atomic_load_n(&poller -> seq, __ATOMIC_ACQUIRE);
+        snapshot -> gpio = __atomic_load_n(&poller -> gpio, __ATOMIC_RELAXED);
+        snapshot -> flags = __atomic_load_n(&poller -> intFlags, __ATOMIC_RELAXED);
+        snapshot -> capture = __atomic_load_n(&poller -> capture, __ATOMIC_RELAXED);
+        snapshot -> error = __atomic_load_n(&poller -> error, __ATOMIC_RELAXED);
+        snapshot -> timestamp = __atomic_load_n(&poller -> timestamp, __ATOMIC_RELAXED);
+        snapshot -> samples = __atomic_load_n(&poller -> samples, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while((seq & 1) || __atomic_load_n(&poller -> seq, __ATOMIC_RELAXED) != seq);
+
+    snapshot -> age = pollNow() - snapshot -> timestamp;
+
+    return snapshot -> error;
+}
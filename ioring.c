@@ -0,0 +1,170 @@
+/* Pin event ring
+ *
+ * Fixed size ring of timestamped port samples between the code reading the
+ * chips and the application.  Any number of threads can push, one thread
+ * drains.  Each slot carries a sequence number so producers claim slots with
+ * a single compare-and-swap and the consumer can tell a slot is filled in
+ * without locks.  Nothing is allocated after ioRingOpen().
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "edgpio.h"
+
+struct ioRingSlot
+{
+    atomic_size_t seq;
+    struct ioPinEvent event;
+};
+
+struct ioRing
+{
+    size_t mask;
+    struct ioRingSlot *slots;
+
+    // Producers and consumer on separate cache lines
+    _Alignas(64) atomic_size_t tail;
+    atomic_ulong overflows;
+    _Alignas(64) size_t head;
+};
+
+ioRing *ioRingOpen(int capacity)
+{
+    /**
+    * Create a pin event ring
+    * @param capacity - number of events held, rounded up to a power of 2
+    * @returns - ring handle
+    */
+
+    ioRing *ring;
+    size_t size;
+    size_t c;
+
+    size = 1;
+    while(size < (size_t)capacity)
+    {
+        size = size * 2;
+    }
+
+    ring = aligned_alloc(64, sizeof(ioRing));
+    memset(ring, 0, sizeof(ioRing));
+    ring -> mask = size - 1;
+    ring -> slots = calloc(size, sizeof(struct ioRingSlot));
+
+    for(c = 0; c < size; c++)
+    {
+        atomic_init(&ring -> slots[c].seq, c);
+    }
+
+    return ring;
+}
+
+void ioRingClose(ioRing *ring)
+{
+    free(ring -> slots);
+    free(ring);
+}
+
+int ioRingPush(ioRing *ring, struct ioPinEvent *event)
+{
+    /**
+    * Add an event.  Safe to call from any number of threads.
+    * @returns - 0, or -1 if the ring was full and the event was dropped
+    */
+
+    struct ioRingSlot *slot;
+    size_t pos;
+    size_t seq;
+
+    pos = atomic_load_explicit(&ring -> tail, memory_order_relaxed);
+    for(;;)
+    {
+        slot = &ring -> slots[pos & ring -> mask];
+        seq = atomic_load_explicit(&slot -> seq, memory_order_acquire);
+
+        if(seq == pos)
+        {
+            if(atomic_compare_exchange_weak_explicit(&ring -> tail, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else
+        {
+            if((intptr_t)(seq - pos) < 0)
+            {
+                atomic_fetch_add_explicit(&ring -> overflows, 1, memory_order_relaxed);
+                return -1;
+            }
+
+            pos = atomic_load_explicit(&ring -> tail, memory_order_relaxed);
+        }
+    }
+
+    slot -> event = *event;
+    atomic_store_explicit(&slot -> seq, pos + 1, memory_order_release);
+
+    return 0;
+}
+
+int ioRingRecord(ioRing *ring, ioDevice *dev, uint8_t port, uint8_t value, uint8_t changed)
+{
+    /**
+    * Add an event stamped with the current CLOCK_MONOTONIC time
+    * @returns - 0, or -1 if the ring was full and the event was dropped
+    */
+
+    struct ioPinEvent event;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    event.timestamp = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    event.dev = dev;
+    event.port = port;
+    event.value = value;
+    event.changed = changed;
+
+    return ioRingPush(ring, &event);
+}
+
+int ioRingDrain(ioRing *ring, struct ioPinEvent *events, int max)
+{
+    /**
+    * Take up to max events, oldest first.  Only one thread may drain a ring.
+    * @returns - number of events copied to events
+    */
+
+    struct ioRingSlot *slot;
+    int count;
+
+    for(count = 0; count < max; count++)
+    {
+        slot = &ring -> slots[ring -> head & ring -> mask];
+        if(atomic_load_explicit(&slot -> seq, memory_order_acquire) != ring -> head + 1)
+        {
+            break;
+        }
+
+        events[count] = slot -> event;
+        atomic_store_explicit(&slot -> seq, ring -> head + ring -> mask + 1, memory_order_release);
+        ring -> head++;
+    }
+
+    return count;
+}
+
+unsigned long ioRingOverflows(ioRing *ring)
+{
+    /**
+    * @returns - number of events dropped because the ring was full
+    */
+
+    return atomic_load_explicit(&ring -> overflows, memory_order_relaxed);
+}
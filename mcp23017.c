@@ -13,6 +13,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sched.h>
 
 #include "edgpio.h"
 #include "i2c.h"
@@ -35,6 +36,7 @@
 #define INTCONA  0x08
 #define INTCONB  0x09
 #define IOCON    0x0A
+#define IOCONB   0x0B
 #define GPPUA    0x0C
 #define GPPUB    0x0D
 #define INTFA    0x0E
@@ -49,11 +51,220 @@
 // See datasheet
 #define IOCON_RESET 0x02
 
-static uint8_t ioAddress = IOADDRESS;
+// IOCON bits
+#define IOCON_MIRROR 6
+#define IOCON_SEQOP  5
+#define IOCON_BANK   7
 
-static uint8_t set_pin(uint8_t pin, uint8_t value, uint8_t reg)
+// GPIO and IOCON addresses with IOCON.BANK = 1, only used while capturing
+#define BANK1_IOCON  0x05
+#define BANK1_GPIOA  0x09
+#define BANK1_OLATA  0x0A
+#define BANK1_PORTB  0x10
+
+// Most bytes read or written in one capture or pattern transaction,
+// the i2c-dev limit.  Less if the bus transport can't do that many,
+// see byte_max() and pattern_max()
+#define CAPTURE_MAX  8192
+
+// Pattern output stream, see ioPatternOpen()
+struct ioPattern
+{
+    ioDevice *dev;
+    int width;
+    uint8_t port;
+    uint8_t reg;
+    uint8_t iocon;
+    uint8_t last[2];
+    int max;
+    uint8_t buffer[CAPTURE_MAX + 1];
+};
+
+// Registers only ever changed by this library are mirrored on the host so
+// reading them, or read-modify-writing a bit in them, costs no bus traffic.
+// GPIO, INTF and INTCAP change under our feet and always go to the chip.
+#define CACHED_REGS ((1 << IODIRA)   | (1 << IODIRB)   | \
+                     (1 << IPOLA)    | (1 << IPOLB)    | \
+                     (1 << GPINTENA) | (1 << GPINTENB) | \
+                     (1 << DEFVALA)  | (1 << DEFVALB)  | \
+                     (1 << INTCONA)  | (1 << INTCONB)  | \
+                     (1 << IOCON)    | (1 << IOCONB)   | \
+                     (1 << GPPUA)    | (1 << GPPUB)    | \
+                     (1 << OLATA)    | (1 << OLATB))
+
+// One MCP23017.  Cached registers written between ioDevBegin() and
+// ioDevCommit() are only marked in dirty and sent as sequential bursts
+// by ioDevCommit()
+struct ioDevice
+{
+    struct i2cBus *bus;
+    uint8_t address;
+    uint8_t shadow[OLATB + 1];
+    uint8_t shadowValid;
+    uint32_t dirty;
+    int batchDepth;
+
+    // First bus error since ioDevGetError() last read it
+    int error;
+
+    // Input samples are logged here if set, see ioDevSetRing()
+    ioRing *ring;
+    uint8_t lastSample[2];
+    uint8_t sampled;
+
+    // GPIO reads come from here if set, see ioDevSetPoller().  Threads
+    // reading through it are counted in pollerReaders.
+    ioPoller *poller;
+    int pollerReaders;
+};
+
+// Device used by the ioXXXX functions, on the bus given to i2cInit()
+static ioDevice ioDefault = { I2C_DEFAULT_BUS, IOADDRESS, { 0 }, 0, 0, 0, 0, NULL, { 0 }, 0, NULL, 0 };
+
+// Log a sample of a port to the device's event ring.  Polled GPIO values
+// are only logged when they differ from the last one seen.
+static void log_sample(ioDevice *dev, uint8_t port, uint8_t value, uint8_t changed)
+{
+    if(dev -> ring == NULL)
+    {
+        return;
+    }
+
+    if(changed != 0 || ((dev -> sampled >> port) & 1) == 0)
+    {
+        ioRingRecord(dev -> ring, dev, port, value, changed);
+    }
+
+    dev -> lastSample[port] = value;
+    dev -> sampled |= 1 << port;
+}
+
+static void log_gpio(ioDevice *dev, uint8_t port, uint8_t value)
+{
+    log_sample(dev, port, value, value ^ dev -> lastSample[port]);
+}
+
+// Remember the first error for ioDevGetError() and pass status through
+static int dev_status(ioDevice *dev, int status)
+{
+    if(status < 0 && dev -> error == 0)
+    {
+        dev -> error = status;
+    }
+
+    return status;
+}
+
+// Set gpio to GPIOA and GPIOB from the poller's latest sample.  Returns 0
+// if no poller is attached, the caller then reads the bus.
+static int polled_gpio(ioDevice *dev, uint16_t *gpio)
+{
+    struct ioInputSnapshot snapshot;
+    ioPoller *poller;
+
+    if(__atomic_load_n(&dev -> poller, __ATOMIC_RELAXED) == NULL)
+    {
+        return 0;
+    }
+
+    // Counted before the load so ioDevSetPoller() can wait for us
+    __atomic_add_fetch(&dev -> pollerReaders, 1, __ATOMIC_SEQ_CST);
+    poller = __atomic_load_n(&dev -> poller, __ATOMIC_ACQUIRE);
+    if(poller != NULL)
+    {
+        dev_status(dev, ioPollerRead(poller, &snapshot));
+        *gpio = snapshot.gpio;
+    }
+    __atomic_sub_fetch(&dev -> pollerReaders, 1, __ATOMIC_RELEASE);
+
+    if(poller == NULL)
+    {
+        return 0;
+    }
+    i2cPerfCached(dev -> address, GPIOA);
+
+    return 1;
+}
+
+// Returns the register value, or a negative errno
+static int read_reg(ioDevice *dev, uint8_t reg)
+{
+    uint16_t gpio;
+    uint8_t value;
+    int status;
+
+    if((reg == GPIOA || reg == GPIOB) && polled_gpio(dev, &gpio))
+    {
+        return (gpio >> ((reg - GPIOA) * 8)) & 0xFF;
+    }
+
+    if((CACHED_REGS >> reg) & 1)
+    {
+        if(dev -> shadowValid == 0)
+        {
+            status = ioDevResyncCache(dev);
+            if(status < 0)
+            {
+                return status;
+            }
+        }
+
+        i2cPerfCached(dev -> address, reg);
+        return dev -> shadow[reg];
+    }
+
+    status = i2cReadByteData(dev -> bus, dev -> address, reg, &value);
+    if(status < 0)
+    {
+        return dev_status(dev, status);
+    }
+
+    if(reg == GPIOA || reg == GPIOB)
+    {
+        log_gpio(dev, reg - GPIOA, value);
+    }
+
+    return value;
+}
+
+static int write_reg(ioDevice *dev, uint8_t reg, uint8_t value)
+{
+    int status;
+
+    if((CACHED_REGS >> reg) & 1)
+    {
+        dev -> shadow[reg] = value;
+
+        // IOCON appears at both addresses in BANK=0 mode
+        if(reg == IOCON)
+        {
+            dev -> shadow[IOCONB] = value;
+        }
+
+        if(dev -> batchDepth > 0)
+        {
+            dev -> dirty |= 1 << reg;
+            if(reg == IOCON)
+            {
+                dev -> dirty |= 1 << IOCONB;
+            }
+            return 0;
+        }
+    }
+
+    status = i2cWriteByteData(dev -> bus, dev -> address, reg, value);
+    if(status < 0)
+    {
+        // The chip may or may not have taken it
+        dev -> shadowValid = 0;
+    }
+
+    return dev_status(dev, status);
+}
+
+static int set_pin(ioDevice *dev, uint8_t pin, uint8_t value, uint8_t reg)
 {
-    uint8_t newVal;
+    int oldVal;
 
     if(pin >= 1 && pin <= 8)
     {
@@ -77,14 +288,19 @@ static uint8_t set_pin(uint8_t pin, uint8_t value, uint8_t reg)
         value = 1;
     }
 
-    newVal = i2cUpdateByte(i2cReadByteData(ioAddress, reg), pin, value);
-    i2cWriteByteData(ioAddress, reg, newVal);
+    oldVal = read_reg(dev, reg);
+    if(oldVal < 0)
+    {
+        return oldVal;
+    }
 
-    return 0;
+    return write_reg(dev, reg, i2cUpdateByte(oldVal, pin, value));
 }
 
-static uint8_t get_pin(uint8_t pin, uint8_t reg)
+static uint8_t get_pin(ioDevice *dev, uint8_t pin, uint8_t reg)
 {
+    int value;
+
     if(pin >= 1 && pin <= 8)
     {
         pin--;
@@ -102,64 +318,268 @@ static uint8_t get_pin(uint8_t pin, uint8_t reg)
         }
     }
 
-    return i2cCheckBit(i2cReadByteData(ioAddress, reg), pin);
+    // Bus errors read as 0, see ioDevGetError()
+    value = read_reg(dev, reg);
+    if(value < 0)
+    {
+        return 0;
+    }
+
+    return i2cCheckBit(value, pin);
 }
 
-static uint8_t set_port(uint8_t port, uint8_t value, uint8_t reg)
+static int set_port(ioDevice *dev, uint8_t port, uint8_t value, uint8_t reg)
 {
     if(port == IO_PORTA)
     {
-        i2cWriteByteData(ioAddress, reg, value);
+        return write_reg(dev, reg, value);
     }
     else
     {
         if(port == IO_PORTB)
         {
-            i2cWriteByteData(ioAddress, reg + 1, value);
+            return write_reg(dev, reg + 1, value);
         }
         else
         {
             return -1;
         }
     }
-
-    return 0;
 }
 
-static uint8_t get_port(uint8_t port, uint8_t reg)
+static uint8_t get_port(ioDevice *dev, uint8_t port, uint8_t reg)
 {
+    int value;
+
     if(port == IO_PORTA)
     {
-        return (i2cReadByteData(ioAddress, reg));
+        value = read_reg(dev, reg);
     }
     else
     {
         if(port == IO_PORTB)
         {
-            return (i2cReadByteData(ioAddress, reg + 1));
+            value = read_reg(dev, reg + 1);
 	}
         else
         {
             return -1;
         }
     }
+
+    // Bus errors read as 0, see ioDevGetError()
+    return value < 0 ? 0 : value;
+}
+
+// 16 bit access to an A/B register pair.  Port A is the low byte.
+// BANK=0 puts the pair at adjacent addresses so both bytes move in one burst.
+static uint16_t get_word(ioDevice *dev, uint8_t reg)
+{
+    uint16_t gpio;
+    uint8_t value[2];
+
+    if(reg == GPIOA && polled_gpio(dev, &gpio))
+    {
+        return gpio;
+    }
+
+    if(((CACHED_REGS >> reg) & 1) && ((CACHED_REGS >> (reg + 1)) & 1))
+    {
+        value[0] = get_port(dev, IO_PORTA, reg);
+        value[1] = get_port(dev, IO_PORTB, reg);
+    }
+    else
+    {
+        if(dev_status(dev, i2cReadByteArray(dev -> bus, dev -> address, reg, value, 2)) < 0)
+        {
+            return 0;
+        }
+        if(reg == GPIOA)
+        {
+            log_gpio(dev, IO_PORTA, value[0]);
+            log_gpio(dev, IO_PORTB, value[1]);
+        }
+    }
+
+    return value[0] | (value[1] << 8);
+}
+
+static int set_word(ioDevice *dev, uint8_t reg, uint16_t value)
+{
+    ioDevBegin(dev);
+    write_reg(dev, reg, value & 0xFF);
+    write_reg(dev, reg + 1, value >> 8);
+    return ioDevCommit(dev);
+}
+
+// New register pair value ((old & ~clear) | set) ^ flip from the host copy.
+// Only ports with a bit in clear, set or flip are written, both together as
+// one burst.
+static int update_word(ioDevice *dev, uint8_t reg, uint16_t clear, uint16_t set, uint16_t flip)
+{
+    uint16_t touched;
+    uint16_t value;
+    int low;
+    int high;
+
+    touched = clear | set | flip;
+    if(touched == 0)
+    {
+        return 0;
+    }
+
+    low = read_reg(dev, reg);
+    if(low < 0)
+    {
+        return low;
+    }
+    high = read_reg(dev, reg + 1);
+    if(high < 0)
+    {
+        return high;
+    }
+
+    value = (((low | (high << 8)) & ~clear) | set) ^ flip;
+
+    ioDevBegin(dev);
+    if(touched & 0x00FF)
+    {
+        write_reg(dev, reg, value & 0xFF);
+    }
+    if(touched & 0xFF00)
+    {
+        write_reg(dev, reg + 1, value >> 8);
+    }
+    return ioDevCommit(dev);
+}
+
+static int init_dev(ioDevice *dev, uint8_t reset)
+{
+    uint8_t burst[OLATB + 2];
+    uint16_t flags;
+    uint16_t capture;
+    int status;
+
+    dev -> shadowValid = 0;
+
+    // Written on its own first as it turns on sequential addressing
+    status = write_reg(dev, IOCON, IOCON_RESET);
+    if(status < 0)
+    {
+        return status;
+    }
+
+    if(reset == 1)
+    {
+        // Everything else in one burst from IODIRA to OLATB.  INTF and
+        // INTCAP ignore writes and GPIO writes go to OLAT, cleared anyway.
+        memset(burst, 0, sizeof(burst));
+        burst[0] = IODIRA;
+        burst[1 + IODIRA] = 0xFF;
+        burst[1 + IODIRB] = 0xFF;
+        burst[1 + IOCON] = IOCON_RESET;
+        burst[1 + IOCONB] = IOCON_RESET;
+
+        status = i2cWriteByteArray(dev -> bus, dev -> address, burst, sizeof(burst));
+        if(status < 0)
+        {
+            return dev_status(dev, status);
+        }
+
+        // Every cached register has just been written
+        memcpy(dev -> shadow, &burst[1], OLATB + 1);
+        dev -> shadowValid = 1;
+
+        // Clear any interrupt still pending from before, both ports at once
+        return ioDevReadInterrupts(dev, &flags, &capture);
+    }
+
+    return ioDevResyncCache(dev);
 }
 
 /*===============================Public Functions===============================*/
 
 
-void ioSetPinDirection(uint8_t pin, uint8_t direction)
+ioDevice *ioOpen(char *busDeviceName, uint8_t busAddress, uint8_t reset)
+{
+    /**
+    * Open an MCP23017
+    * Any number of devices can be open at once, on up to four buses
+    * @param busDeviceName - I2C bus the chip is on eg. "/dev/i2c-1"
+    * @param busAddress - 0x20 to 0x27
+    * @param reset - If set to 1 reset registers to default values. Ports are inputs, pull-up resistors are disabled and ports are not inverted.
+    * @returns - handle to pass to the ioDevXXXX functions, NULL if the chip can't be reached
+    */
+
+    ioDevice *dev;
+
+    dev = calloc(1, sizeof(ioDevice));
+    dev -> bus = i2cOpenBus(busDeviceName);
+    dev -> address = busAddress;
+
+    if(dev -> bus == NULL || init_dev(dev, reset) < 0)
+    {
+        free(dev);
+        return NULL;
+    }
+
+    return dev;
+}
+
+ioDevice *ioDefaultDevice()
+{
+    /**
+    * Get the device the ioXXXX functions use
+    * @returns - handle for the ioDevXXXX functions
+    */
+
+    return &ioDefault;
+}
+
+void ioClose(ioDevice *dev)
+{
+    /**
+    * Free a handle returned by ioOpen()
+    * Pending batched writes are sent first
+    */
+
+    dev -> batchDepth = 1;
+    ioDevCommit(dev);
+    free(dev);
+}
+
+int ioDevGetError(ioDevice *dev)
+{
+    /**
+    * Get and clear the first bus error since the last call
+    * Functions that return a value read from the chip return 0 when the bus
+    * fails, this tells them apart from a real 0.
+    * @returns - 0, or a negative errno eg. -ENXIO if the chip didn't answer
+    */
+
+    int error;
+
+    error = dev -> error;
+    dev -> error = 0;
+
+    return error;
+}
+
+
+
+int ioDevSetPinDirection(ioDevice *dev, uint8_t pin, uint8_t direction)
 {
     /**
     * Set IO direction for an individual pin
     * @param pins - 1 to 16
     * @param direction - 1 = input, 0 = output
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
-    set_pin(pin, direction, IODIRA);
+    return set_pin(dev, pin, direction, IODIRA);
 }
 
-uint8_t ioGetPinDirection(uint8_t pin)
+uint8_t ioDevGetPinDirection(ioDevice *dev, uint8_t pin)
 {
     /**
     * Get IO direction for an individual pin
@@ -167,21 +587,22 @@ uint8_t ioGetPinDirection(uint8_t pin)
     * @returns 1 = input, 0 = output
     */
 
-    return get_pin(pin, IODIRA);
+    return get_pin(dev, pin, IODIRA);
 }
 
-void ioSetPortDirection(uint8_t port, uint8_t direction)
+int ioDevSetPortDirection(ioDevice *dev, uint8_t port, uint8_t direction)
 {
     /**
     * Set direction for an IO port
     * @param port - 0 = pins 1 to 8, port 1 = pins 9 to 16
     * @param direction - 0 to 255 (0xFF).  For each bit 1 = input, 0 = output
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
-    set_port(port, direction, IODIRA);
+    return set_port(dev, port, direction, IODIRA);
 }
 
-uint8_t ioGetPortDirection(uint8_t port)
+uint8_t ioDevGetPortDirection(ioDevice *dev, uint8_t port)
 {
     /**
     * Get the direction for an IO port
@@ -189,21 +610,22 @@ uint8_t ioGetPortDirection(uint8_t port)
     * @returns 0 to 255 (0xFF).  For each bit 1 = input, 0 = output
     */
 
-    return get_port(port, IODIRA);
+    return get_port(dev, port, IODIRA);
 }
 
-void ioSetPinPullup(uint8_t pin, uint8_t value)
+int ioDevSetPinPullup(ioDevice *dev, uint8_t pin, uint8_t value)
 {
     /**
     * Set the internal 100K pull-up resistors for an individual pin
     * @param pin - 1 to 16
     * @param value - 1 = enabled, 0 = disabled
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
-    set_pin(pin, value, GPPUA);
+    return set_pin(dev, pin, value, GPPUA);
 }
 
-uint8_t ioGetPinPullup(uint8_t pin)
+uint8_t ioDevGetPinPullup(ioDevice *dev, uint8_t pin)
 {
     /**
     * Get the internal 100K pull-up resistors for an individual pin
@@ -211,21 +633,22 @@ uint8_t ioGetPinPullup(uint8_t pin)
     * @returns 1 = enabled, 0 = disabled
     */
 
-    return get_pin(pin, GPPUA);
+    return get_pin(dev, pin, GPPUA);
 }
 
-void ioSetPortPullups(uint8_t port, uint8_t value)
+int ioDevSetPortPullups(ioDevice *dev, uint8_t port, uint8_t value)
 {
     /**
     * Set the internal 100K pull-up resistors for the selected IO port
     * @param port - 0 = pins 1 to 8, port 1 = pins 9 to 16
     * @param value - 0 to 255 (0xFF). For each bit 1 = enabled, 0 = disabled
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
-    set_port(port, value, GPPUA);
+    return set_port(dev, port, value, GPPUA);
 }
 
-uint8_t ioGetPortPullups(uint8_t port)
+uint8_t ioDevGetPortPullups(ioDevice *dev, uint8_t port)
 {
     /**
     * Get the internal 100K pull-up resistors for the selected IO port
@@ -233,32 +656,34 @@ uint8_t ioGetPortPullups(uint8_t port)
     * @returns 0 to 255 (0xFF). For each bit 1 = enabled, 0 = disabled
     */
 
-    return get_port(port, GPPUA);
+    return get_port(dev, port, GPPUA);
 }
 
-void ioWritePin(uint8_t pin, uint8_t value)
+int ioDevWritePin(ioDevice *dev, uint8_t pin, uint8_t value)
 {
     /**
     * Write to an individual pin 1 - 16
     * @param pin - 1 to 16
     * @param value - 0 = logic low, 1 = logic high
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
-    set_pin(pin, value, GPIOA);
+    return set_pin(dev, pin, value, OLATA);
 }
 
-void ioWritePort(uint8_t port, uint8_t value)
+int ioDevWritePort(ioDevice *dev, uint8_t port, uint8_t value)
 {
     /**
     * Write to all pins on the selected port
     * @param port - 0 = pins 1 to 8, port 1 = pins 9 to 16
     * @param value - 0 to 255 (0xFF)
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
-    set_port(port, value, GPIOA);
+    return set_port(dev, port, value, OLATA);
 }
 
-uint8_t ioReadPin(uint8_t pin)
+uint8_t ioDevReadPin(ioDevice *dev, uint8_t pin)
 {
     /**
     * Read the value of an individual pin
@@ -266,10 +691,10 @@ uint8_t ioReadPin(uint8_t pin)
     * @returns - 0 = logic low, 1 = logic high
     */
 
-    return get_pin(pin, GPIOA);
+    return get_pin(dev, pin, GPIOA);
 }
 
-uint8_t ioReadPort(uint8_t port)
+uint8_t ioDevReadPort(ioDevice *dev, uint8_t port)
 {
     /**
     * Read all pins on the selected port
@@ -277,26 +702,27 @@ uint8_t ioReadPort(uint8_t port)
     * @returns - 0 to 255 (0xFF). For each bit 1 = logic high, 0 = logic low
     */
 
-    return get_port(port, GPIOA);
+    return get_port(dev, port, GPIOA);
 }
 
-uint8_t ioReadOutputLatch(uint8_t port)
+uint8_t ioDevReadOutputLatch(ioDevice *dev, uint8_t port)
 {
-    return get_port(port, OLATA);
+    return get_port(dev, port, OLATA);
 }
 
-void ioSetInterruptType(uint8_t port, uint8_t value)
+int ioDevSetInterruptType(ioDevice *dev, uint8_t port, uint8_t value)
 {
     /**
     * Sets the type of interrupt for each pin on the selected port
     * @param port - 0 = pins 1 to 8, port 1 = pins 9 to 16
     * @param value - 0 to 255 (0xFF). For each bit 1 = interrupt is fired when the pin matches the default value, 0 = the interrupt is fired on state change
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
-    set_port(port, value, INTCONA);
+    return set_port(dev, port, value, INTCONA);
 }
 
-uint8_t ioGetInterruptType(uint8_t port)
+uint8_t ioDevGetInterruptType(ioDevice *dev, uint8_t port)
 {
     /**
     * Get the type of interrupt for each pin on the selected port
@@ -304,22 +730,23 @@ uint8_t ioGetInterruptType(uint8_t port)
     * @returns 0 to 255 (0xFF). For each bit 1 = interrupt is fired when the pin matches the default value, 0 = the interrupt is fired on state change
     */
 
-    return get_port(port, INTCONA);
+    return get_port(dev, port, INTCONA);
 }
 
-void ioSetInterruptDefaults(uint8_t port, uint8_t value)
+int ioDevSetInterruptDefaults(ioDevice *dev, uint8_t port, uint8_t value)
 {
     /**
     * These bits set the compare value for pins configured for interrupt-on-change on the selected port.
     * If the associated pin level is the opposite of the register bit, an interrupt occurs.
     * @param port - 0 = pins 1 to 8, port 1 = pins 9 to 16
     * @param value - default state for the port. 0 to 255 (0xFF).
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
-    set_port(port, value, DEFVALA);
+    return set_port(dev, port, value, DEFVALA);
 }
 
-uint8_t ioGetInterruptDefaults(uint8_t port)
+uint8_t ioDevGetInterruptDefaults(ioDevice *dev, uint8_t port)
 {
     /**
     * Get the compare value for pins configured for interrupt-on-change on the selected port.
@@ -328,43 +755,45 @@ uint8_t ioGetInterruptDefaults(uint8_t port)
     * @returns default state for the port. 0 to 255 (0xFF).
     */
 
-    return get_port(port, DEFVALA);
+    return get_port(dev, port, DEFVALA);
 }
 
-void ioSetInterruptOnPin(uint8_t pin, uint8_t value)
+int ioDevSetInterruptOnPin(ioDevice *dev, uint8_t pin, uint8_t value)
 {
     /**
     * Enable interrupts for the selected pin
     * @param pin - 1 to 16
     * @param value - 0 = interrupt disabled, 1 = interrupt enabled
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
-    set_pin(pin, value, GPINTENA);
+    return set_pin(dev, pin, value, GPINTENA);
 }
 
- uint8_t ioGetInterruptOnPin(uint8_t pin)
- {
+uint8_t ioDevGetInterruptOnPin(ioDevice *dev, uint8_t pin)
+{
     /**
     * Get the interrupt-enable status for the selected pin
     * @param pin - 1 to 16
     * @returns 0 = interrupt disabled, 1 = interrupt enabled
     */
 
-    return get_pin(pin, GPINTENA);
- }
+    return get_pin(dev, pin, GPINTENA);
+}
 
-void ioSetInterruptOnPort(uint8_t port, uint8_t value)
+int ioDevSetInterruptOnPort(ioDevice *dev, uint8_t port, uint8_t value)
 {
     /**
     * Enable interrupts for the pins on the selected port
     * @param port - 0 = pins 1 to 8, port 1 = pins 9 to 16
     * @param value - 0 to 255 (0xFF). For each bit 0 = interrupt disabled, 1 = interrupt enabled
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
-    set_port(port, value, GPINTENA);
+    return set_port(dev, port, value, GPINTENA);
 }
 
-uint8_t ioGetInterruptOnPort(uint8_t port)
+uint8_t ioDevGetInterruptOnPort(ioDevice *dev, uint8_t port)
 {
     /**
     * Get the interrupt-enable status for the selected port
@@ -372,10 +801,10 @@ uint8_t ioGetInterruptOnPort(uint8_t port)
     * @returns 0 to 255 (0xFF). For each bit 0 = interrupt disabled, 1 = interrupt enabled
     */
 
-    return get_port(port, GPINTENA);
+    return get_port(dev, port, GPINTENA);
 }
 
-uint8_t ioReadInterruptStatus(uint8_t port)
+uint8_t ioDevReadInterruptStatus(ioDevice *dev, uint8_t port)
 {
     /**
     * Read the interrupt status for the pins on the selected port
@@ -383,10 +812,10 @@ uint8_t ioReadInterruptStatus(uint8_t port)
     * @returns - 0 to 255 (0xFF). For each bit 1 = interrupt triggered, 0 = interrupt not triggered
     */
 
-    return get_port(port, INTFA);
+    return get_port(dev, port, INTFA);
 }
 
-uint8_t ioReadInterruptCapture(uint8_t port)
+uint8_t ioDevReadInterruptCapture(ioDevice *dev, uint8_t port)
 {
     /**
     * Read the value from the selected port at the time of the last interrupt trigger
@@ -394,53 +823,1323 @@ uint8_t ioReadInterruptCapture(uint8_t port)
     * @returns - 0 to 255 (0xFF). For each bit 1 = interrupt triggered, 0 = interrupt not triggered
     */
 
-    return get_port(port, INTCAPA);
+    return get_port(dev, port, INTCAPA);
 }
 
-void ioAckInterrupts(uint8_t port)
+int ioDevAckInterrupts(ioDevice *dev, uint8_t port)
 {
     /**
     * Reset the interrupts on port
+    * @returns - 0, -1 if out of range, or a negative errno on bus error
     */
 
+    int status;
+
+    if(port != IO_PORTA && port != IO_PORTB)
+    {
+        return -1;
+    }
+
 //    usleep(200000);
-    ioReadInterruptCapture(port);
+    status = read_reg(dev, INTCAPA + port);
+
+    return status < 0 ? status : 0;
 }
 
-void ioInit(uint8_t reset, uint8_t busAddress)
+uint16_t ioDevReadWord(ioDevice *dev)
 {
     /**
-    * Initialise the MCP32017 IO chip
-    * @param reset - If set to 1 reset registers to default values. Ports are inputs, pull-up resistors are disabled and ports are not inverted.
-    * @param busAddress - if non-zero, use this as i2c bus address for MCP23017, otherwise use default
+    * Read all 16 pins in one transaction, both ports are sampled together
+    * @returns - 0 to 65535 (0xFFFF). Bit 0 = pin 1, bit 15 = pin 16.  For each bit 1 = logic high, 0 = logic low
     */
 
-    if(busAddress != 0)
-    {
-        ioAddress = busAddress;
-    }
-    else
-    {
-        ioAddress = IOADDRESS;
-    }
+    return get_word(dev, GPIOA);
+}
 
-    i2cWriteByteData(ioAddress, IOCON, IOCON_RESET);
-    if(reset == 1)
-    {
-        i2cWriteByteData(ioAddress, GPIOA, 0x00);
-        i2cWriteByteData(ioAddress, GPIOB, 0x00);
-        i2cWriteByteData(ioAddress, IODIRA, 0xFF);
-        i2cWriteByteData(ioAddress, IODIRB, 0xFF);
-        i2cWriteByteData(ioAddress, GPPUA, 0x00);
-        i2cWriteByteData(ioAddress, GPPUB, 0x00);
-        i2cWriteByteData(ioAddress, IPOLA, 0x00);
-        i2cWriteByteData(ioAddress, IPOLB, 0x00);
-	i2cWriteByteData(ioAddress, GPINTENA, 0x00);
-	i2cWriteByteData(ioAddress, GPINTENB, 0x00);
-        i2cWriteByteData(ioAddress, DEFVALA, 0x00);
-        i2cWriteByteData(ioAddress, DEFVALB, 0x00);
-
-        ioAckInterrupts(IO_PORTA);
-        ioAckInterrupts(IO_PORTB);
-    }
+int ioDevWriteWord(ioDevice *dev, uint16_t value)
+{
+    /**
+    * Write all 16 pins in one transaction
+    * @param value - 0 to 65535 (0xFFFF). Bit 0 = pin 1, bit 15 = pin 16
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return set_word(dev, OLATA, value);
+}
+
+int ioDevWritePinsMasked(ioDevice *dev, uint16_t mask, uint16_t values)
+{
+    /**
+    * Write several pins at once, the others keep their output latch value
+    * The new latch is worked out from the host copy so this is one write of
+    * the port, or one burst of both ports, and the pins change together.
+    * @param mask - pins to write. Bit 0 = pin 1, bit 15 = pin 16
+    * @param values - levels for the pins in mask, other bits are ignored
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return update_word(dev, OLATA, mask, values & mask, 0);
+}
+
+int ioDevSetPins(ioDevice *dev, uint16_t mask)
+{
+    /**
+    * Set the pins in mask high in one transaction
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return update_word(dev, OLATA, 0, mask, 0);
+}
+
+int ioDevClearPins(ioDevice *dev, uint16_t mask)
+{
+    /**
+    * Set the pins in mask low in one transaction
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return update_word(dev, OLATA, mask, 0, 0);
+}
+
+int ioDevTogglePins(ioDevice *dev, uint16_t mask)
+{
+    /**
+    * Invert the output latch of the pins in mask in one transaction
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return update_word(dev, OLATA, 0, 0, mask);
+}
+
+int ioDevSetDirectionMasked(ioDevice *dev, uint16_t mask, uint16_t direction)
+{
+    /**
+    * Set the direction of several pins at once, the others keep theirs
+    * If the current directions can't be read nothing is written.
+    * @param mask - pins to set. Bit 0 = pin 1, bit 15 = pin 16
+    * @param direction - for each pin in mask 1 = input, 0 = output
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return update_word(dev, IODIRA, mask, direction & mask, 0);
+}
+
+int ioDevSetPullupsMasked(ioDevice *dev, uint16_t mask, uint16_t value)
+{
+    /**
+    * Set the pull-ups of several pins at once, the others keep theirs
+    * If the current pull-ups can't be read nothing is written.
+    * @param mask - pins to set. Bit 0 = pin 1, bit 15 = pin 16
+    * @param value - for each pin in mask 1 = enabled, 0 = disabled
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return update_word(dev, GPPUA, mask, value & mask, 0);
+}
+
+int ioDevSetWordDirection(ioDevice *dev, uint16_t direction)
+{
+    /**
+    * Set direction for all 16 pins
+    * @param direction - 0 to 65535 (0xFFFF). Bit 0 = pin 1.  For each bit 1 = input, 0 = output
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return set_word(dev, IODIRA, direction);
+}
+
+uint16_t ioDevGetWordDirection(ioDevice *dev)
+{
+    /**
+    * Get the direction for all 16 pins
+    * @returns 0 to 65535 (0xFFFF). Bit 0 = pin 1.  For each bit 1 = input, 0 = output
+    */
+
+    return get_word(dev, IODIRA);
+}
+
+int ioDevSetWordPullups(ioDevice *dev, uint16_t value)
+{
+    /**
+    * Set the internal 100K pull-up resistors for all 16 pins
+    * @param value - 0 to 65535 (0xFFFF). Bit 0 = pin 1.  For each bit 1 = enabled, 0 = disabled
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return set_word(dev, GPPUA, value);
+}
+
+uint16_t ioDevGetWordPullups(ioDevice *dev)
+{
+    /**
+    * Get the internal 100K pull-up resistors for all 16 pins
+    * @returns 0 to 65535 (0xFFFF). Bit 0 = pin 1.  For each bit 1 = enabled, 0 = disabled
+    */
+
+    return get_word(dev, GPPUA);
+}
+
+int ioDevSetWordInterruptType(ioDevice *dev, uint16_t value)
+{
+    /**
+    * Sets the type of interrupt for all 16 pins
+    * @param value - 0 to 65535 (0xFFFF). Bit 0 = pin 1.  For each bit 1 = compare against default value, 0 = state change
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return set_word(dev, INTCONA, value);
+}
+
+uint16_t ioDevGetWordInterruptType(ioDevice *dev)
+{
+    /**
+    * Get the type of interrupt for all 16 pins
+    * @returns 0 to 65535 (0xFFFF). Bit 0 = pin 1.  For each bit 1 = compare against default value, 0 = state change
+    */
+
+    return get_word(dev, INTCONA);
+}
+
+int ioDevSetWordInterruptDefaults(ioDevice *dev, uint16_t value)
+{
+    /**
+    * Set the interrupt compare value for all 16 pins
+    * @param value - 0 to 65535 (0xFFFF). Bit 0 = pin 1
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return set_word(dev, DEFVALA, value);
+}
+
+uint16_t ioDevGetWordInterruptDefaults(ioDevice *dev)
+{
+    /**
+    * Get the interrupt compare value for all 16 pins
+    * @returns 0 to 65535 (0xFFFF). Bit 0 = pin 1
+    */
+
+    return get_word(dev, DEFVALA);
+}
+
+int ioDevSetInterruptOnWord(ioDevice *dev, uint16_t value)
+{
+    /**
+    * Enable interrupts for all 16 pins
+    * @param value - 0 to 65535 (0xFFFF). Bit 0 = pin 1.  For each bit 0 = interrupt disabled, 1 = interrupt enabled
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    return set_word(dev, GPINTENA, value);
+}
+
+uint16_t ioDevGetInterruptOnWord(ioDevice *dev)
+{
+    /**
+    * Get the interrupt-enable status for all 16 pins
+    * @returns 0 to 65535 (0xFFFF). Bit 0 = pin 1.  For each bit 0 = interrupt disabled, 1 = interrupt enabled
+    */
+
+    return get_word(dev, GPINTENA);
+}
+
+uint16_t ioDevReadWordInterruptStatus(ioDevice *dev)
+{
+    /**
+    * Read the interrupt status for all 16 pins
+    * @returns - 0 to 65535 (0xFFFF). Bit 0 = pin 1.  For each bit 1 = interrupt triggered, 0 = interrupt not triggered
+    */
+
+    return get_word(dev, INTFA);
+}
+
+uint16_t ioDevReadWordInterruptCapture(ioDevice *dev)
+{
+    /**
+    * Read all 16 pins as they were at the time of the last interrupt trigger
+    * @returns - 0 to 65535 (0xFFFF). Bit 0 = pin 1
+    */
+
+    return get_word(dev, INTCAPA);
+}
+
+int ioDevReadInterrupts(ioDevice *dev, uint16_t *flags, uint16_t *capture)
+{
+    /**
+    * Read the interrupt flags and captured values for all 16 pins in one burst
+    * Reading the capture registers clears the interrupt
+    * @param flags - set to INTF, bit 0 = pin 1.  For each bit 1 = pin caused the interrupt
+    * @param capture - set to INTCAP, the pin values when the interrupt fired
+    * @returns - 0, or a negative errno on bus error with flags and capture set to 0
+    */
+
+    uint8_t regs[4];
+    int status;
+
+    status = i2cReadByteArray(dev -> bus, dev -> address, INTFA, regs, 4);
+    if(status < 0)
+    {
+        *flags = 0;
+        *capture = 0;
+        return dev_status(dev, status);
+    }
+
+    *flags = regs[0] | (regs[1] << 8);
+    *capture = regs[2] | (regs[3] << 8);
+
+    if(regs[0] != 0)
+    {
+        log_sample(dev, IO_PORTA, regs[2], regs[0]);
+    }
+    if(regs[1] != 0)
+    {
+        log_sample(dev, IO_PORTB, regs[3], regs[1]);
+    }
+
+    return 0;
+}
+
+int ioDevSetInterruptMirror(ioDevice *dev, uint8_t value)
+{
+    /**
+    * Join the INTA and INTB outputs so either port's interrupts drive both pins
+    * @param value - 1 = enabled, 0 = disabled (INTA for port A, INTB for port B)
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    int iocon;
+
+    iocon = read_reg(dev, IOCON);
+    if(iocon < 0)
+    {
+        return iocon;
+    }
+
+    return write_reg(dev, IOCON, i2cUpdateByte(iocon, IOCON_MIRROR, value));
+}
+
+// Most bytes per transaction in byte mode.  Each transaction starts again
+// from the register address, so a transfer the transport would split can't
+// be left to it.  Kept even so 16 bit transfers stay A, B aligned.
+static int byte_max(ioDevice *dev)
+{
+    int max;
+
+    max = i2cMaxTransfer(dev -> bus);
+    if(max > CAPTURE_MAX)
+    {
+        max = CAPTURE_MAX;
+    }
+
+    return max & ~1;
+}
+
+// Most pattern bytes in one write.  The register address goes in the same
+// message, and 16 bit patterns must end each write on OLATB.
+static int pattern_max(ioDevice *dev, int width)
+{
+    int max;
+
+    max = i2cMaxTransfer(dev -> bus) - 1;
+    if(max > CAPTURE_MAX)
+    {
+        max = CAPTURE_MAX;
+    }
+
+    return width == 16 ? max & ~1 : max;
+}
+
+static uint64_t capture_time()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int ioDevCapturePort(ioDevice *dev, uint8_t port, uint8_t *samples, int count, struct ioCaptureTime *time)
+{
+    /**
+    * Sample one port as fast as the bus allows
+    * The chip is put in byte mode with IOCON.BANK = 1 so a long read returns
+    * the same GPIO register over and over, every byte is a new sample.
+    * IOCON is put back afterwards.  Don't use the device from another thread
+    * during a capture, the register addresses are different until it ends.
+    * @param port - 0 = pins 1 to 8, port 1 = pins 9 to 16
+    * @param samples - buffer for count samples
+    * @param time - set to the times the first transaction started and the last ended, may be NULL
+    * @returns - count, -1 if port is out of range, or a negative errno on bus error
+    */
+
+    int iocon;
+    int status;
+    int restore;
+    uint8_t reg;
+    int done;
+    int length;
+    int max;
+
+    if(port != IO_PORTA && port != IO_PORTB)
+    {
+        return -1;
+    }
+
+    iocon = read_reg(dev, IOCON);
+    if(iocon < 0)
+    {
+        return iocon;
+    }
+    reg = BANK1_GPIOA + (port == IO_PORTB ? BANK1_PORTB : 0);
+
+    status = i2cWriteByteData(dev -> bus, dev -> address, IOCON, iocon | (1 << IOCON_BANK) | (1 << IOCON_SEQOP));
+    if(status < 0)
+    {
+        dev -> shadowValid = 0;
+        return dev_status(dev, status);
+    }
+
+    if(time != NULL)
+    {
+        time -> start = capture_time();
+    }
+
+    max = byte_max(dev);
+    for(done = 0; done < count && status == 0; done += length)
+    {
+        length = count - done;
+        if(length > max)
+        {
+            length = max;
+        }
+        status = i2cReadByteArray(dev -> bus, dev -> address, reg, &samples[done], length);
+    }
+
+    if(time != NULL)
+    {
+        time -> end = capture_time();
+    }
+
+    // Put IOCON back even if the capture failed
+    restore = i2cWriteByteData(dev -> bus, dev -> address, BANK1_IOCON, iocon);
+    if(status == 0)
+    {
+        status = restore;
+    }
+
+    if(status < 0)
+    {
+        dev -> shadowValid = 0;
+        return dev_status(dev, status);
+    }
+
+    return count;
+}
+
+int ioDevCaptureWord(ioDevice *dev, uint16_t *samples, int count, struct ioCaptureTime *time)
+{
+    /**
+    * Sample both ports as fast as the bus allows
+    * In byte mode with IOCON.BANK = 0 the register pointer toggles between
+    * GPIOA and GPIOB, so a long read returns A, B, A, B...  IOCON is put back
+    * afterwards.
+    * @param samples - buffer for count samples, port A in the low byte
+    * @param time - set to the times the first transaction started and the last ended, may be NULL
+    * @returns - count, or a negative errno on bus error
+    */
+
+    uint8_t *bytes;
+    int iocon;
+    int status;
+    int restore;
+    int done;
+    int length;
+    int max;
+    int c;
+
+    iocon = read_reg(dev, IOCON);
+    if(iocon < 0)
+    {
+        return iocon;
+    }
+    bytes = (uint8_t *)samples;
+
+    status = i2cWriteByteData(dev -> bus, dev -> address, IOCON, iocon | (1 << IOCON_SEQOP));
+    if(status < 0)
+    {
+        dev -> shadowValid = 0;
+        return dev_status(dev, status);
+    }
+
+    if(time != NULL)
+    {
+        time -> start = capture_time();
+    }
+
+    max = byte_max(dev);
+    for(done = 0; done < count * 2 && status == 0; done += length)
+    {
+        length = count * 2 - done;
+        if(length > max)
+        {
+            length = max;
+        }
+        status = i2cReadByteArray(dev -> bus, dev -> address, GPIOA, &bytes[done], length);
+    }
+
+    if(time != NULL)
+    {
+        time -> end = capture_time();
+    }
+
+    // Put IOCON back even if the capture failed
+    restore = i2cWriteByteData(dev -> bus, dev -> address, IOCON, iocon);
+    if(status == 0)
+    {
+        status = restore;
+    }
+
+    if(status < 0)
+    {
+        dev -> shadowValid = 0;
+        return dev_status(dev, status);
+    }
+
+    // A then B in memory, make them host order words
+    for(c = 0; c < count; c++)
+    {
+        samples[c] = bytes[c * 2] | (bytes[c * 2 + 1] << 8);
+    }
+
+    return count;
+}
+
+ioPattern *ioPatternOpen(ioDevice *dev, int width, uint8_t port)
+{
+    /**
+    * Start streaming output patterns to a device
+    * The chip is put in byte mode so every byte of a long write to the output
+    * latch is a new output state.  8 bit patterns also set IOCON.BANK = 1 so
+    * the writes stay on one port, 16 bit patterns use BANK = 0 where the
+    * pointer toggles between OLATA and OLATB.  Don't use the device for
+    * anything else until ioPatternClose().
+    * @param width - 8 for one port, 16 for both
+    * @param port - port for 8 bit patterns, 0 = pins 1 to 8, port 1 = pins 9 to 16
+    * @returns - pattern handle, NULL if width or port is out of range or on bus error
+    */
+
+    ioPattern *pat;
+    int iocon;
+    int status;
+
+    if((width != 8 && width != 16) || (port != IO_PORTA && port != IO_PORTB))
+    {
+        return NULL;
+    }
+
+    iocon = read_reg(dev, IOCON);
+    if(iocon < 0)
+    {
+        return NULL;
+    }
+
+    pat = malloc(sizeof(ioPattern));
+    pat -> dev = dev;
+    pat -> width = width;
+    pat -> port = port;
+    pat -> iocon = iocon;
+    pat -> max = pattern_max(dev, width);
+    pat -> last[0] = dev -> shadow[OLATA];
+    pat -> last[1] = dev -> shadow[OLATB];
+
+    if(width == 8)
+    {
+        pat -> reg = BANK1_OLATA + (port == IO_PORTB ? BANK1_PORTB : 0);
+        status = i2cWriteByteData(dev -> bus, dev -> address, IOCON, pat -> iocon | (1 << IOCON_BANK) | (1 << IOCON_SEQOP));
+    }
+    else
+    {
+        pat -> reg = OLATA;
+        status = i2cWriteByteData(dev -> bus, dev -> address, IOCON, pat -> iocon | (1 << IOCON_SEQOP));
+    }
+
+    if(status < 0)
+    {
+        dev -> shadowValid = 0;
+        dev_status(dev, status);
+        free(pat);
+        return NULL;
+    }
+
+    return pat;
+}
+
+// Copy count pattern values into the transaction buffer after the register
+// address, 16 bit values go A then B
+static int pattern_fill(ioPattern *pat, uint8_t *to, void *values, int count)
+{
+    uint16_t *words;
+    int c;
+
+    if(pat -> width == 8)
+    {
+        memcpy(to, values, count);
+        return count;
+    }
+
+    words = values;
+    for(c = 0; c < count; c++)
+    {
+        to[c * 2] = words[c] & 0xFF;
+        to[c * 2 + 1] = words[c] >> 8;
+    }
+
+    return count * 2;
+}
+
+static int pattern_send(ioPattern *pat, int length)
+{
+    int status;
+
+    pat -> buffer[0] = pat -> reg;
+    status = i2cWriteByteArray(pat -> dev -> bus, pat -> dev -> address, pat -> buffer, length + 1);
+    if(status < 0)
+    {
+        return dev_status(pat -> dev, status);
+    }
+
+    if(pat -> width == 8)
+    {
+        pat -> last[pat -> port] = pat -> buffer[length];
+    }
+    else
+    {
+        pat -> last[0] = pat -> buffer[length - 1];
+        pat -> last[1] = pat -> buffer[length];
+    }
+
+    return 0;
+}
+
+int ioPatternWrite(ioPattern *pat, void *values, int count)
+{
+    /**
+    * Stream values to the outputs, one output state per byte on the bus
+    * Call repeatedly to feed a long pattern in pieces
+    * @param values - uint8_t values for 8 bit patterns, uint16_t (port A in the low byte) for 16 bit
+    * @param count - number of values
+    * @returns - count, or a negative errno on bus error
+    */
+
+    int size;
+    int chunk;
+    int done;
+    int status;
+
+    size = pat -> width / 8;
+    for(done = 0; done < count; done += chunk)
+    {
+        chunk = count - done;
+        if(chunk * size > pat -> max)
+        {
+            chunk = pat -> max / size;
+        }
+
+        status = pattern_send(pat, pattern_fill(pat, &pat -> buffer[1], (uint8_t *)values + done * size, chunk));
+        if(status < 0)
+        {
+            return status;
+        }
+    }
+
+    return count;
+}
+
+int ioPatternLoop(ioPattern *pat, void *values, int count, int loops)
+{
+    /**
+    * Stream a pattern loops times
+    * Short patterns are repeated inside each transaction so there is no gap
+    * between repeats except where a transaction ends
+    * @returns - count * loops, or a negative errno on bus error
+    */
+
+    int size;
+    int copies;
+    int send;
+    int status;
+    int c;
+
+    size = pat -> width / 8;
+    if(count == 0 || count * size > pat -> max)
+    {
+        for(c = 0; c < loops; c++)
+        {
+            status = ioPatternWrite(pat, values, count);
+            if(status < 0)
+            {
+                return status;
+            }
+        }
+        return count * loops;
+    }
+
+    copies = pat -> max / (count * size);
+    if(copies > loops)
+    {
+        copies = loops;
+    }
+
+    for(c = 0; c < copies; c++)
+    {
+        pattern_fill(pat, &pat -> buffer[1 + c * count * size], values, count);
+    }
+
+    for(c = loops; c > 0; c -= send)
+    {
+        send = c < copies ? c : copies;
+        status = pattern_send(pat, send * count * size);
+        if(status < 0)
+        {
+            return status;
+        }
+    }
+
+    return count * loops;
+}
+
+void ioPatternClose(ioPattern *pat)
+{
+    /**
+    * Stop streaming, put IOCON back and free the handle
+    * The outputs are left at the last value written
+    */
+
+    ioDevice *dev;
+    int status;
+
+    dev = pat -> dev;
+    if(pat -> width == 8)
+    {
+        status = i2cWriteByteData(dev -> bus, dev -> address, BANK1_IOCON, pat -> iocon);
+    }
+    else
+    {
+        status = i2cWriteByteData(dev -> bus, dev -> address, IOCON, pat -> iocon);
+    }
+
+    if(status < 0)
+    {
+        dev -> shadowValid = 0;
+        dev_status(dev, status);
+    }
+
+    dev -> shadow[OLATA] = pat -> last[0];
+    dev -> shadow[OLATB] = pat -> last[1];
+
+    free(pat);
+}
+
+void ioDevSetRing(ioDevice *dev, ioRing *ring)
+{
+    /**
+    * Log input samples to a pin event ring
+    * GPIO reads are logged when a port's value changes, interrupt reads with
+    * ioDevReadInterrupts() log the captured value with INTF as the changed mask.
+    * @param ring - ring to log to, NULL to stop
+    */
+
+    dev -> ring = ring;
+    dev -> sampled = 0;
+}
+
+void ioDevSetPoller(ioDevice *dev, ioPoller *poller)
+{
+    /**
+    * Serve GPIO reads from a poller's latest sample, done by ioPollerOpen()
+    * Returns once no other thread is reading through the previous poller,
+    * so it can then be freed.
+    * @param poller - poller reading this device, NULL to read the bus again
+    */
+
+    __atomic_store_n(&dev -> poller, poller, __ATOMIC_SEQ_CST);
+
+    while(__atomic_load_n(&dev -> pollerReaders, __ATOMIC_SEQ_CST) != 0)
+    {
+        sched_yield();
+    }
+}
+
+int ioDevSampleInputs(ioDevice *dev, uint16_t *gpio, uint16_t *flags, uint16_t *capture)
+{
+    /**
+    * Read the inputs from the chip, whether or not a poller is running
+    * With flags and capture set INTF, INTCAP and GPIO are read in one burst,
+    * which acknowledges any interrupt.  Samples are logged to the ring.
+    * @param gpio - set to GPIO, bit 0 = pin 1
+    * @param flags - NULL, or set to INTF
+    * @param capture - NULL, or set to INTCAP
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    uint8_t regs[6];
+    uint8_t *port;
+    int status;
+
+    if(flags != NULL && capture != NULL)
+    {
+        status = i2cReadByteArray(dev -> bus, dev -> address, INTFA, regs, 6);
+        port = &regs[4];
+    }
+    else
+    {
+        status = i2cReadByteArray(dev -> bus, dev -> address, GPIOA, regs, 2);
+        port = regs;
+    }
+
+    if(status < 0)
+    {
+        return dev_status(dev, status);
+    }
+
+    if(port != regs)
+    {
+        *flags = regs[0] | (regs[1] << 8);
+        *capture = regs[2] | (regs[3] << 8);
+    }
+    *gpio = port[0] | (port[1] << 8);
+
+    log_gpio(dev, IO_PORTA, port[0]);
+    log_gpio(dev, IO_PORTB, port[1]);
+
+    return 0;
+}
+
+void ioDevBegin(ioDevice *dev)
+{
+    /**
+    * Start a batch of register writes.  Writes made until the matching ioDevCommit(dev)
+    * only update the host copy of the registers.
+    * Batches may be nested, only the outermost ioDevCommit() sends anything.
+    */
+
+    dev -> batchDepth++;
+}
+
+int ioDevCommit(ioDevice *dev)
+{
+    /**
+    * Send the register writes made since ioDevBegin().
+    * Changed registers are sent in address order as sequential burst writes.
+    * Runs are merged across unchanged registers whose value is known, so a
+    * full reconfiguration takes one burst for 0x00 - 0x0D and one for OLAT.
+    * If a burst fails the rest are dropped and the cache is reloaded on next use.
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    uint8_t burst[OLATB + 2];
+    uint32_t bridge;
+    int status;
+    int start;
+    int end;
+    int reg;
+
+    if(dev -> batchDepth == 0)
+    {
+        return 0;
+    }
+
+    dev -> batchDepth--;
+    if(dev -> batchDepth > 0)
+    {
+        return 0;
+    }
+
+    bridge = dev -> dirty;
+    if(dev -> shadowValid == 1)
+    {
+        bridge |= CACHED_REGS;
+    }
+
+    status = 0;
+    start = 0;
+    while(start <= OLATB && status == 0)
+    {
+        if((dev -> dirty >> start) & 1)
+        {
+            end = start;
+            for(reg = start + 1; reg <= OLATB && ((bridge >> reg) & 1); reg++)
+            {
+                if((dev -> dirty >> reg) & 1)
+                {
+                    end = reg;
+                }
+            }
+
+            burst[0] = start;
+            memcpy(&burst[1], &dev -> shadow[start], end - start + 1);
+            status = i2cWriteByteArray(dev -> bus, dev -> address, burst, end - start + 2);
+
+            start = end;
+        }
+
+        start++;
+    }
+
+    dev -> dirty = 0;
+    if(status < 0)
+    {
+        dev -> shadowValid = 0;
+    }
+
+    return dev_status(dev, status);
+}
+
+void ioDevInvalidateCache(ioDevice *dev)
+{
+    /**
+    * Forget the host copy of the configuration and output latch registers.
+    * They are read back from the chip on next use.
+    * Call this if the MCP23017 may have been reset or changed by something else.
+    */
+
+    dev -> shadowValid = 0;
+}
+
+// Refresh the host copy from a read of the registers, keeping values
+// waiting in an open batch
+static void load_shadow(ioDevice *dev, uint8_t *regs)
+{
+    int reg;
+
+    for(reg = 0; reg <= OLATB; reg++)
+    {
+        if(((CACHED_REGS & ~dev -> dirty) >> reg) & 1)
+        {
+            dev -> shadow[reg] = regs[reg];
+        }
+    }
+
+    dev -> shadowValid = 1;
+}
+
+int ioDevResyncCache(ioDevice *dev)
+{
+    /**
+    * Reload the host copy of the configuration and output latch registers now
+    * IODIRA to GPPUB are read in one sequential burst, OLATA and OLATB in another.
+    * INTCAP and GPIO are skipped as reading them clears pending interrupts.
+    * Values written inside an open batch are kept.
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    uint8_t regs[OLATB + 1];
+    int status;
+
+    status = i2cReadByteArray(dev -> bus, dev -> address, IODIRA, regs, GPPUB + 1);
+    if(status == 0)
+    {
+        status = i2cReadByteArray(dev -> bus, dev -> address, OLATA, &regs[OLATA], 2);
+    }
+    if(status < 0)
+    {
+        return dev_status(dev, status);
+    }
+
+    load_shadow(dev, regs);
+
+    return 0;
+}
+
+int ioDevSnapshot(ioDevice *dev, struct ioRegisterSnapshot *snapshot)
+{
+    /**
+    * Read every register, IODIRA to OLATB, in one sequential burst
+    * This reads INTCAP and GPIO, which acknowledges any interrupt.  The
+    * host copy of the configuration is refreshed from it on the way.
+    * @param snapshot - set to the registers, in BANK=0 order
+    * @returns - 0, or a negative errno on bus error
+    */
+
+    int status;
+
+    status = i2cReadByteArray(dev -> bus, dev -> address, IODIRA, snapshot -> regs, IO_REGISTERS);
+    if(status < 0)
+    {
+        return dev_status(dev, status);
+    }
+
+    load_shadow(dev, snapshot -> regs);
+    log_gpio(dev, IO_PORTA, snapshot -> regs[GPIOA]);
+    log_gpio(dev, IO_PORTB, snapshot -> regs[GPIOB]);
+
+    return 0;
+}
+
+uint32_t ioDiff(struct ioRegisterSnapshot *a, struct ioRegisterSnapshot *b)
+{
+    /**
+    * Compare two snapshots
+    * @returns - bit n set if register n differs, 0 if they match
+    */
+
+    uint32_t diff;
+    int reg;
+
+    diff = 0;
+    for(reg = 0; reg < IO_REGISTERS; reg++)
+    {
+        if(a -> regs[reg] != b -> regs[reg])
+        {
+            diff |= 1 << reg;
+        }
+    }
+
+    return diff;
+}
+
+int ioDevApply(ioDevice *dev, struct ioRegisterSnapshot *from, struct ioRegisterSnapshot *to)
+{
+    /**
+    * Change the chip from one snapshot to another, writing only what differs
+    * The differing writable registers (all but INTF, INTCAP and GPIO) are
+    * sent as sequential bursts through ioDevBegin()/ioDevCommit(), so runs
+    * are merged across registers whose value is known and inside an open
+    * batch nothing is sent until it's committed.
+    * @param from - the chip's current state, usually from ioDevSnapshot()
+    * @param to - the state wanted
+    * IOCON BANK and SEQOP must be 0 in both.  BANK moves the registers and
+    * SEQOP stops a burst stepping through them, so either would send the
+    * rest of a burst to the wrong register.
+    * @returns - 0, -1 if either sets IOCON BANK or SEQOP, or a negative
+    *            errno on bus error
+    */
+
+    uint32_t diff;
+    int reg;
+
+    if((from -> regs[IOCON] | from -> regs[IOCONB] | to -> regs[IOCON] | to -> regs[IOCONB]) &
+       ((1 << IOCON_BANK) | (1 << IOCON_SEQOP)))
+    {
+        return -1;
+    }
+
+    diff = ioDiff(from, to) & CACHED_REGS;
+    if(diff == 0)
+    {
+        return 0;
+    }
+
+    ioDevBegin(dev);
+    for(reg = 0; reg < IO_REGISTERS; reg++)
+    {
+        if((diff >> reg) & 1)
+        {
+            write_reg(dev, reg, to -> regs[reg]);
+        }
+    }
+
+    return ioDevCommit(dev);
+}
+
+/*===============================Default Device===============================*/
+
+int ioInit(uint8_t reset, uint8_t busAddress)
+{
+    /**
+    * Initialise the MCP32017 IO chip
+    * @param reset - If set to 1 reset registers to default values. Ports are inputs, pull-up resistors are disabled and ports are not inverted.
+    * @param busAddress - if non-zero, use this as i2c bus address for MCP23017, otherwise use default
+    * @returns - 0, or a negative errno if the chip can't be reached
+    */
+
+    if(busAddress != 0)
+    {
+        ioDefault.address = busAddress;
+    }
+    else
+    {
+        ioDefault.address = IOADDRESS;
+    }
+
+    return init_dev(&ioDefault, reset);
+}
+
+int ioSetPinDirection(uint8_t pin, uint8_t direction)
+{
+    return ioDevSetPinDirection(&ioDefault, pin, direction);
+}
+
+uint8_t ioGetPinDirection(uint8_t pin)
+{
+    return ioDevGetPinDirection(&ioDefault, pin);
+}
+
+int ioSetPortDirection(uint8_t port, uint8_t direction)
+{
+    return ioDevSetPortDirection(&ioDefault, port, direction);
+}
+
+uint8_t ioGetPortDirection(uint8_t port)
+{
+    return ioDevGetPortDirection(&ioDefault, port);
+}
+
+int ioSetPinPullup(uint8_t pin, uint8_t value)
+{
+    return ioDevSetPinPullup(&ioDefault, pin, value);
+}
+
+uint8_t ioGetPinPullup(uint8_t pin)
+{
+    return ioDevGetPinPullup(&ioDefault, pin);
+}
+
+int ioSetPortPullups(uint8_t port, uint8_t value)
+{
+    return ioDevSetPortPullups(&ioDefault, port, value);
+}
+
+uint8_t ioGetPortPullups(uint8_t port)
+{
+    return ioDevGetPortPullups(&ioDefault, port);
+}
+
+int ioWritePin(uint8_t pin, uint8_t value)
+{
+    return ioDevWritePin(&ioDefault, pin, value);
+}
+
+int ioWritePort(uint8_t port, uint8_t value)
+{
+    return ioDevWritePort(&ioDefault, port, value);
+}
+
+uint8_t ioReadPin(uint8_t pin)
+{
+    return ioDevReadPin(&ioDefault, pin);
+}
+
+uint8_t ioReadPort(uint8_t port)
+{
+    return ioDevReadPort(&ioDefault, port);
+}
+
+uint8_t ioReadOutputLatch(uint8_t port)
+{
+    return ioDevReadOutputLatch(&ioDefault, port);
+}
+
+int ioSetInterruptType(uint8_t port, uint8_t value)
+{
+    return ioDevSetInterruptType(&ioDefault, port, value);
+}
+
+uint8_t ioGetInterruptType(uint8_t port)
+{
+    return ioDevGetInterruptType(&ioDefault, port);
+}
+
+int ioSetInterruptDefaults(uint8_t port, uint8_t value)
+{
+    return ioDevSetInterruptDefaults(&ioDefault, port, value);
+}
+
+uint8_t ioGetInterruptDefaults(uint8_t port)
+{
+    return ioDevGetInterruptDefaults(&ioDefault, port);
+}
+
+int ioSetInterruptOnPin(uint8_t pin, uint8_t value)
+{
+    return ioDevSetInterruptOnPin(&ioDefault, pin, value);
+}
+
+uint8_t ioGetInterruptOnPin(uint8_t pin)
+{
+    return ioDevGetInterruptOnPin(&ioDefault, pin);
+}
+
+int ioSetInterruptOnPort(uint8_t port, uint8_t value)
+{
+    return ioDevSetInterruptOnPort(&ioDefault, port, value);
+}
+
+uint8_t ioGetInterruptOnPort(uint8_t port)
+{
+    return ioDevGetInterruptOnPort(&ioDefault, port);
+}
+
+uint8_t ioReadInterruptStatus(uint8_t port)
+{
+    return ioDevReadInterruptStatus(&ioDefault, port);
+}
+
+uint8_t ioReadInterruptCapture(uint8_t port)
+{
+    return ioDevReadInterruptCapture(&ioDefault, port);
+}
+
+int ioAckInterrupts(uint8_t port)
+{
+    return ioDevAckInterrupts(&ioDefault, port);
+}
+
+uint16_t ioReadWord()
+{
+    return ioDevReadWord(&ioDefault);
+}
+
+int ioWriteWord(uint16_t value)
+{
+    return ioDevWriteWord(&ioDefault, value);
+}
+
+int ioWritePinsMasked(uint16_t mask, uint16_t values)
+{
+    return ioDevWritePinsMasked(&ioDefault, mask, values);
+}
+
+int ioSetPins(uint16_t mask)
+{
+    return ioDevSetPins(&ioDefault, mask);
+}
+
+int ioClearPins(uint16_t mask)
+{
+    return ioDevClearPins(&ioDefault, mask);
+}
+
+int ioTogglePins(uint16_t mask)
+{
+    return ioDevTogglePins(&ioDefault, mask);
+}
+
+int ioSetDirectionMasked(uint16_t mask, uint16_t direction)
+{
+    return ioDevSetDirectionMasked(&ioDefault, mask, direction);
+}
+
+int ioSetPullupsMasked(uint16_t mask, uint16_t value)
+{
+    return ioDevSetPullupsMasked(&ioDefault, mask, value);
+}
+
+int ioSetWordDirection(uint16_t direction)
+{
+    return ioDevSetWordDirection(&ioDefault, direction);
+}
+
+uint16_t ioGetWordDirection()
+{
+    return ioDevGetWordDirection(&ioDefault);
+}
+
+int ioSetWordPullups(uint16_t value)
+{
+    return ioDevSetWordPullups(&ioDefault, value);
+}
+
+uint16_t ioGetWordPullups()
+{
+    return ioDevGetWordPullups(&ioDefault);
+}
+
+int ioSetWordInterruptType(uint16_t value)
+{
+    return ioDevSetWordInterruptType(&ioDefault, value);
+}
+
+uint16_t ioGetWordInterruptType()
+{
+    return ioDevGetWordInterruptType(&ioDefault);
+}
+
+int ioSetWordInterruptDefaults(uint16_t value)
+{
+    return ioDevSetWordInterruptDefaults(&ioDefault, value);
+}
+
+uint16_t ioGetWordInterruptDefaults()
+{
+    return ioDevGetWordInterruptDefaults(&ioDefault);
+}
+
+int ioSetInterruptOnWord(uint16_t value)
+{
+    return ioDevSetInterruptOnWord(&ioDefault, value);
+}
+
+uint16_t ioGetInterruptOnWord()
+{
+    return ioDevGetInterruptOnWord(&ioDefault);
+}
+
+uint16_t ioReadWordInterruptStatus()
+{
+    return ioDevReadWordInterruptStatus(&ioDefault);
+}
+
+uint16_t ioReadWordInterruptCapture()
+{
+    return ioDevReadWordInterruptCapture(&ioDefault);
+}
+
+int ioReadInterrupts(uint16_t *flags, uint16_t *capture)
+{
+    return ioDevReadInterrupts(&ioDefault, flags, capture);
+}
+
+int ioSetInterruptMirror(uint8_t value)
+{
+    return ioDevSetInterruptMirror(&ioDefault, value);
+}
+
+int ioCapturePort(uint8_t port, uint8_t *samples, int count, struct ioCaptureTime *time)
+{
+    return ioDevCapturePort(&ioDefault, port, samples, count, time);
+}
+
+int ioCaptureWord(uint16_t *samples, int count, struct ioCaptureTime *time)
+{
+    return ioDevCaptureWord(&ioDefault, samples, count, time);
+}
+
+void ioSetRing(ioRing *ring)
+{
+    ioDevSetRing(&ioDefault, ring);
+}
+
+void ioBegin()
+{
+    ioDevBegin(&ioDefault);
+}
+
+int ioCommit()
+{
+    return ioDevCommit(&ioDefault);
+}
+
+void ioInvalidateCache()
+{
+    ioDevInvalidateCache(&ioDefault);
+}
+
+int ioResyncCache()
+{
+    return ioDevResyncCache(&ioDefault);
+}
+
+int ioSnapshot(struct ioRegisterSnapshot *snapshot)
+{
+    return ioDevSnapshot(&ioDefault, snapshot);
+}
+
+int ioApply(struct ioRegisterSnapshot *from, struct ioRegisterSnapshot *to)
+{
+    return ioDevApply(&ioDefault, from, to);
+}
+
+int ioGetError()
+{
+    return ioDevGetError(&ioDefault);
 }
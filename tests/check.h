@@ -0,0 +1,105 @@
+//
+// Checks for the simulator tests
+//
+//   Each test program runs against I2C_SIM_BUS and exits non-zero if any
+//   CHECK() failed.  "make test" builds and runs them all.
+//
+
+#ifndef __GOT_CHECK
+#define __GOT_CHECK
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "edgpio.h"
+
+// MCP23017 registers in BANK=0 order, for i2cSimGetRegister()
+#define SIM_IODIRA   0x00
+#define SIM_IODIRB   0x01
+#define SIM_IPOLA    0x02
+#define SIM_IPOLB    0x03
+#define SIM_GPINTENA 0x04
+#define SIM_GPINTENB 0x05
+#define SIM_DEFVALA  0x06
+#define SIM_DEFVALB  0x07
+#define SIM_INTCONA  0x08
+#define SIM_INTCONB  0x09
+#define SIM_IOCON    0x0A
+#define SIM_IOCONB   0x0B
+#define SIM_GPPUA    0x0C
+#define SIM_GPPUB    0x0D
+#define SIM_INTFA    0x0E
+#define SIM_INTFB    0x0F
+#define SIM_INTCAPA  0x10
+#define SIM_INTCAPB  0x11
+#define SIM_GPIOA    0x12
+#define SIM_GPIOB    0x13
+#define SIM_OLATA    0x14
+#define SIM_OLATB    0x15
+
+#define SIM_RTCADDRESS 0x68
+
+static int checkFailures = 0;
+
+// The bus API takes char *, which a string literal isn't in C++
+static char checkBus[] = I2C_SIM_BUS;
+
+#define CHECK(cond) check_result((cond) != 0, #cond, __FILE__, __LINE__)
+
+static inline void check_result(int ok, const char *what, const char *file, int line)
+{
+    if(!ok)
+    {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+        checkFailures++;
+    }
+}
+
+// Fresh simulator with the default device at 0x20 reset.  Errors aren't
+// retried, so each i2cSimFail() transaction fails one call.
+static inline void check_setup()
+{
+    i2cInit(checkBus, 32, 32, 1);
+    i2cSimReset();
+    i2cSimSetTiming(0, 0);
+    i2cSimFail(0, 0, 0);
+
+    ioInit(1, 0);
+}
+
+// Performance counters of a device, all 0 if it hasn't been used since
+// i2cPerfReset()
+static inline struct i2cPerfDevice check_counters(uint8_t address)
+{
+    struct i2cPerf perf;
+    struct i2cPerfDevice none;
+    int c;
+
+    i2cPerfSnapshot(&perf);
+    for(c = 0; c < I2C_PERF_DEVICES; c++)
+    {
+        if(perf.devices[c].address == (0x100u | address))
+        {
+            return perf.devices[c];
+        }
+    }
+
+    memset(&none, 0, sizeof(none));
+    return none;
+}
+
+// A simulated register pair, port A in the low byte
+static inline int check_word(uint8_t address, uint8_t reg)
+{
+    return i2cSimGetRegister(address, reg) | (i2cSimGetRegister(address, reg + 1) << 8);
+}
+
+static inline int check_done(const char *name)
+{
+    printf("%s: %s\n", name, checkFailures == 0 ? "ok" : "FAILED");
+
+    return checkFailures != 0;
+}
+
+#endif
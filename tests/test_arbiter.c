@@ -0,0 +1,192 @@
+// Bus arbiter: bulk chunking, byte mode transfers under the bulk class,
+// deadlines and priority order
+
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "check.h"
+
+static int order[2];
+static int finished;
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = ms * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+// Holds the bus for one slow transaction
+static void *hold_bus(void *arg)
+{
+    ioReadPort(IO_PORTA);
+
+    return arg;
+}
+
+// Queues behind hold_bus() with the class in arg, records when it got on
+static void *queued(void *arg)
+{
+    uint8_t byte;
+
+    i2cSetPriority((long)arg, 0);
+    rtcReadMemory(RTCMEMSTART, 1, &byte);
+    order[__atomic_fetch_add(&finished, 1, __ATOMIC_RELAXED)] = (long)arg;
+
+    return NULL;
+}
+
+static void test_byte_mode()
+{
+    uint8_t values[40];
+    uint16_t words[20];
+    uint8_t samples[40];
+    ioPattern *pat;
+    int iocon;
+    int c;
+
+    check_setup();
+    iocon = i2cSimGetRegister(0x20, SIM_IOCON);
+    i2cSetBulkChunk(8);
+    i2cSetPriority(I2C_CLASS_BULK, 0);
+
+    CHECK(ioSetWordDirection(0xFF00) == 0);
+    CHECK(ioWritePort(IO_PORTB, 0x00) == 0);
+
+    // 8 bit pattern: every byte goes to OLATA, nothing after it
+    for(c = 0; c < 40; c++)
+    {
+        values[c] = c + 1;
+    }
+    pat = ioPatternOpen(ioDefaultDevice(), 8, IO_PORTA);
+    CHECK(pat != NULL);
+    CHECK(ioPatternWrite(pat, values, 40) == 40);
+    ioPatternClose(pat);
+
+    CHECK(i2cSimGetRegister(0x20, SIM_OLATA) == 40);
+    CHECK(i2cSimGetRegister(0x20, SIM_OLATB) == 0x00);
+    CHECK(i2cSimGetRegister(0x20, SIM_GPINTENB) == 0x00);
+    CHECK(i2cSimGetRegister(0x20, SIM_IOCON) == iocon);
+    CHECK(ioReadOutputLatch(IO_PORTA) == 40);
+
+    // 16 bit pattern: bytes alternate OLATA, OLATB
+    CHECK(ioSetWordDirection(0x0000) == 0);
+    for(c = 0; c < 20; c++)
+    {
+        words[c] = 0x0101 * c;
+    }
+    words[19] = 0xBEEF;
+    pat = ioPatternOpen(ioDefaultDevice(), 16, IO_PORTA);
+    CHECK(pat != NULL);
+    CHECK(ioPatternWrite(pat, words, 20) == 20);
+    ioPatternClose(pat);
+
+    CHECK(i2cSimGetOutputs(0x20) == 0xBEEF);
+    CHECK(i2cSimGetRegister(0x20, SIM_IODIRA) == 0x00);
+    CHECK(i2cSimGetRegister(0x20, SIM_IODIRB) == 0x00);
+    CHECK(i2cSimGetRegister(0x20, SIM_IOCON) == iocon);
+
+    // Capture: every byte comes from GPIOB
+    CHECK(ioSetWordDirection(0xFF00) == 0);
+    i2cSimSetInputs(0x20, 0x3C00);
+    memset(samples, 0, sizeof(samples));
+    CHECK(ioCapturePort(IO_PORTB, samples, 40, NULL) == 40);
+    for(c = 0; c < 40; c++)
+    {
+        CHECK(samples[c] == 0x3C);
+    }
+    CHECK(i2cSimGetRegister(0x20, SIM_IOCON) == iocon);
+
+    i2cSetPriority(I2C_CLASS_AUTO, 0);
+}
+
+static void test_chunks()
+{
+    uint8_t values[RTCMEMSIZE - RTCMEMSTART];
+    uint8_t readBack[RTCMEMSIZE - RTCMEMSTART];
+    uint64_t writes;
+    int c;
+
+    check_setup();
+    i2cSetBulkChunk(8);
+
+    // RTC memory writes are split, the data still lands in order
+    for(c = 0; c < (int)sizeof(values); c++)
+    {
+        values[c] = 0x80 + c;
+    }
+    writes = check_counters(SIM_RTCADDRESS).writes;
+    CHECK(rtcWriteMemory(RTCMEMSTART, sizeof(values), values) == 0);
+    CHECK(check_counters(SIM_RTCADDRESS).writes - writes == 7);
+    for(c = 0; c < (int)sizeof(values); c++)
+    {
+        CHECK(i2cSimGetRegister(SIM_RTCADDRESS, RTCMEMSTART + c) == 0x80 + c);
+    }
+    CHECK(rtcReadMemory(RTCMEMSTART, sizeof(readBack), readBack) == 0);
+    CHECK(memcmp(values, readBack, sizeof(values)) == 0);
+
+    // The NVRAM flush stays one burst
+    CHECK(rtcNvramLoad(0) == 0);
+    memset(values, 0x11, sizeof(values));
+    CHECK(rtcNvramWrite(RTCMEMSTART, sizeof(values), values) == 0);
+    writes = check_counters(SIM_RTCADDRESS).writes;
+    CHECK(rtcNvramFlush() == sizeof(values));
+    CHECK(check_counters(SIM_RTCADDRESS).writes - writes == 1);
+
+    // Chunk 0 sends bulk transfers whole
+    i2cSetBulkChunk(0);
+    writes = check_counters(SIM_RTCADDRESS).writes;
+    CHECK(rtcWriteMemory(RTCMEMSTART, sizeof(values), values) == 0);
+    CHECK(check_counters(SIM_RTCADDRESS).writes - writes == 1);
+    i2cSetBulkChunk(8);
+}
+
+static void test_scheduling()
+{
+    struct i2cPerf perf;
+    pthread_t holder;
+    pthread_t waiters[2];
+    uint8_t byte;
+
+    check_setup();
+    i2cSimSetTiming(0, 50000000);
+
+    // A deadline that passes while the bus is held fails the transfer
+    i2cPerfReset();
+    pthread_create(&holder, NULL, hold_bus, NULL);
+    sleep_ms(10);
+    i2cSetPriority(I2C_CLASS_NORMAL, 1000);
+    CHECK(rtcReadMemory(RTCMEMSTART, 1, &byte) == -ETIMEDOUT);
+    i2cSetPriority(I2C_CLASS_AUTO, 0);
+    pthread_join(holder, NULL);
+    i2cPerfSnapshot(&perf);
+    CHECK(perf.missed[I2C_CLASS_NORMAL] == 1);
+    CHECK(perf.latency[I2C_PERF_WAIT + I2C_CLASS_NORMAL].count == 1);
+
+    // A realtime transfer queued after a bulk one still goes first
+    finished = 0;
+    pthread_create(&holder, NULL, hold_bus, NULL);
+    sleep_ms(10);
+    pthread_create(&waiters[0], NULL, queued, (void *)(long)I2C_CLASS_BULK);
+    sleep_ms(10);
+    pthread_create(&waiters[1], NULL, queued, (void *)(long)I2C_CLASS_REALTIME);
+    pthread_join(holder, NULL);
+    pthread_join(waiters[0], NULL);
+    pthread_join(waiters[1], NULL);
+    CHECK(order[0] == I2C_CLASS_REALTIME);
+    CHECK(order[1] == I2C_CLASS_BULK);
+
+    i2cSimSetTiming(0, 0);
+}
+
+int main()
+{
+    test_byte_mode();
+    test_chunks();
+    test_scheduling();
+
+    return check_done("arbiter");
+}
@@ -0,0 +1,116 @@
+// Asynchronous requests: submission order, both completion modes, the
+// depth limit and errors passed to callbacks
+
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "check.h"
+
+#define REQUESTS 8
+
+struct result
+{
+    int result;
+    uint32_t value;
+    int order;
+    pthread_t thread;
+};
+
+static struct result results[REQUESTS];
+static int finished;
+
+static void done(void *context, int result, uint32_t value)
+{
+    struct result *r;
+
+    r = context;
+    r -> result = result;
+    r -> value = value;
+    r -> order = finished++;
+    r -> thread = pthread_self();
+}
+
+static void reset_results()
+{
+    memset(results, 0, sizeof(results));
+    finished = 0;
+}
+
+int main()
+{
+    struct pollfd pfd;
+    i2cAsync *async;
+    uint8_t written[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    uint8_t readBack[8];
+    int c;
+
+    check_setup();
+    CHECK(ioSetWordDirection(0xFF00) == 0);
+    i2cSimSetInputs(0x20, 0xA500);
+
+    // Callback mode: run in submission order on the worker thread
+    reset_results();
+    async = i2cAsyncOpen(REQUESTS, I2C_ASYNC_CALLBACK);
+    CHECK(async != NULL);
+    CHECK(ioWritePortAsync(async, IO_PORTA, 0x34, done, &results[0]) == 0);
+    CHECK(ioReadWordAsync(async, done, &results[1]) == 0);
+    CHECK(ioWritePinAsync(async, 1, 1, done, &results[2]) == 0);
+    CHECK(ioReadPinAsync(async, 1, done, &results[3]) == 0);
+    CHECK(rtcWriteMemoryAsync(async, RTCMEMSTART, sizeof(written), written, done, &results[4]) == 0);
+    CHECK(rtcReadMemoryAsync(async, RTCMEMSTART, sizeof(readBack), readBack, done, &results[5]) == 0);
+    i2cAsyncClose(async);
+
+    CHECK(finished == 6);
+    for(c = 0; c < 6; c++)
+    {
+        CHECK(results[c].order == c);
+        CHECK(results[c].result == 0);
+        CHECK(!pthread_equal(results[c].thread, pthread_self()));
+    }
+    CHECK(results[1].value == 0xA534);
+    CHECK(results[3].value == 1);
+    CHECK(memcmp(written, readBack, sizeof(written)) == 0);
+
+    // Bus errors reach the callback
+    reset_results();
+    async = i2cAsyncOpen(REQUESTS, I2C_ASYNC_CALLBACK);
+    i2cSimFail(0x20, 1, -EIO);
+    CHECK(ioReadWordAsync(async, done, &results[0]) == 0);
+    CHECK(ioReadWordAsync(async, done, &results[1]) == 0);
+    i2cAsyncClose(async);
+    CHECK(results[0].result == -EIO);
+    CHECK(results[1].result == 0);
+    CHECK(results[1].value == 0xA535);
+
+    // Eventfd mode: callbacks run on the thread that completes them
+    reset_results();
+    async = i2cAsyncOpen(REQUESTS, I2C_ASYNC_EVENTFD);
+    CHECK(ioReadPortAsync(async, IO_PORTB, done, &results[0]) == 0);
+    CHECK(ioWriteWordAsync(async, 0x0077, done, &results[1]) == 0);
+    pfd.fd = i2cAsyncFd(async);
+    pfd.events = POLLIN;
+    c = 0;
+    while(finished < 2 && poll(&pfd, 1, 1000) == 1)
+    {
+        c += i2cAsyncComplete(async);
+    }
+    CHECK(c == 2);
+    CHECK(results[0].result == 0 && results[0].value == 0xA5);
+    CHECK(pthread_equal(results[0].thread, pthread_self()));
+    CHECK(i2cSimGetOutputs(0x20) == 0x0077);
+    CHECK(i2cAsyncComplete(async) == 0);
+
+    // No more than depth requests in flight, counting ones not completed
+    CHECK(ioReadPortAsync(async, IO_PORTB, done, &results[2]) == 0);
+    CHECK(ioReadPortAsync(async, IO_PORTB, done, &results[3]) == 0);
+    for(c = 2; c < REQUESTS; c++)
+    {
+        CHECK(ioReadPortAsync(async, IO_PORTB, NULL, NULL) == 0);
+    }
+    CHECK(ioReadPortAsync(async, IO_PORTB, NULL, NULL) == -1);
+    i2cAsyncClose(async);
+    CHECK(finished == 4);
+
+    return check_done("async");
+}
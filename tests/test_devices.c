@@ -0,0 +1,56 @@
+// Word writes on a second device: one burst on that device, the default
+// device and any batch open on it are left alone
+
+#include "check.h"
+
+int main()
+{
+    struct i2cPerfDevice perf;
+    ioDevice *dev;
+
+    check_setup();
+    CHECK(ioSetWordDirection(0x0000) == 0);
+    CHECK(ioWriteWord(0x1234) == 0);
+    dev = ioOpen(checkBus, 0x21, 1);
+    CHECK(dev != NULL);
+    if(dev == NULL)
+    {
+        return check_done("devices");
+    }
+
+    // Each word goes out as one two byte burst to the second device
+    i2cPerfReset();
+    CHECK(ioDevSetWordDirection(dev, 0x00FF) == 0);
+    CHECK(ioDevSetWordPullups(dev, 0xF00F) == 0);
+    CHECK(ioDevWriteWord(dev, 0xBEEF) == 0);
+    CHECK(check_word(0x21, SIM_IODIRA) == 0x00FF);
+    CHECK(check_word(0x21, SIM_GPPUA) == 0xF00F);
+    CHECK(check_word(0x21, SIM_OLATA) == 0xBEEF);
+    perf = check_counters(0x21);
+    CHECK(perf.writes == 3);
+    CHECK(perf.bytesWritten == 6);
+
+    // The default device sees no traffic and keeps its registers
+    perf = check_counters(0x20);
+    CHECK(perf.reads == 0);
+    CHECK(perf.writes == 0);
+    CHECK(check_word(0x20, SIM_IODIRA) == 0x0000);
+    CHECK(check_word(0x20, SIM_GPPUA) == 0x0000);
+    CHECK(check_word(0x20, SIM_OLATA) == 0x1234);
+
+    // A batch open on the default device holds its own writes only
+    i2cPerfReset();
+    ioBegin();
+    CHECK(ioWriteWord(0x5555) == 0);
+    CHECK(ioDevWriteWord(dev, 0xCAFE) == 0);
+    CHECK(check_word(0x21, SIM_OLATA) == 0xCAFE);
+    CHECK(check_counters(0x21).writes == 1);
+    CHECK(check_word(0x20, SIM_OLATA) == 0x1234);
+    CHECK(check_counters(0x20).writes == 0);
+    CHECK(ioCommit() == 0);
+    CHECK(check_word(0x20, SIM_OLATA) == 0x5555);
+    CHECK(check_counters(0x20).writes == 1);
+
+    ioClose(dev);
+    return check_done("devices");
+}
@@ -0,0 +1,87 @@
+// Pin change events through a pipe standing in for the GPIO line, and an
+// interrupt that couldn't be read is picked up by the next wait
+
+#include <string.h>
+#include <unistd.h>
+#include <linux/gpio.h>
+
+#include "check.h"
+
+static int lastPin;
+static int lastValue;
+static int calls;
+
+static void on_pin(void *context, ioDevice *dev, uint8_t pin, uint8_t value, uint64_t timestamp)
+{
+    (void)context;
+    (void)dev;
+    (void)timestamp;
+
+    lastPin = pin;
+    lastValue = value;
+    calls++;
+}
+
+// The INT output went active, what the kernel would queue on the line
+static void edge(int fd, uint64_t timestamp)
+{
+    struct gpio_v2_line_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.timestamp_ns = timestamp;
+    event.id = GPIO_V2_LINE_EVENT_RISING_EDGE;
+    CHECK(write(fd, &event, sizeof(event)) == sizeof(event));
+}
+
+static int interrupt_pending(uint8_t address)
+{
+    return i2cSimGetRegister(address, SIM_INTFA) != 0 || i2cSimGetRegister(address, SIM_INTFB) != 0;
+}
+
+int main()
+{
+    ioDevice *dev;
+    ioEvents *events;
+    int line[2];
+
+    check_setup();
+
+    dev = ioOpen(checkBus, 0x21, 1);
+    CHECK(dev != NULL);
+    CHECK(ioDevSetInterruptOnWord(dev, 0x0003) == 0);
+    CHECK(pipe(line) == 0);
+
+    events = ioEventsOpenFd(dev, line[0]);
+    CHECK(events != NULL);
+    CHECK(ioEventsOnPin(events, 0, on_pin, NULL) == 0);
+
+    // Nothing waiting
+    CHECK(ioEventsWait(events, 0) == 0);
+
+    // One edge, one capture read, one callback
+    i2cSimSetInputs(0x21, 0x0001);
+    CHECK(interrupt_pending(0x21));
+    edge(line[1], 100);
+    CHECK(ioEventsWait(events, 0) == 1);
+    CHECK(calls == 1 && lastPin == 1 && lastValue == 1);
+    CHECK(!interrupt_pending(0x21));
+
+    // The capture read fails: INT stays asserted and no new edge comes, the
+    // next wait must read it without one
+    i2cSimSetInputs(0x21, 0x0003);
+    edge(line[1], 200);
+    i2cSimFail(0x21, 1, -EIO);
+    CHECK(ioEventsWait(events, 0) == -EIO);
+    CHECK(interrupt_pending(0x21));
+    CHECK(calls == 1);
+    CHECK(ioEventsWait(events, 0) == 1);
+    CHECK(calls == 2 && lastPin == 2 && lastValue == 1);
+    CHECK(!interrupt_pending(0x21));
+    CHECK(ioEventsWait(events, 0) == 0);
+
+    ioEventsClose(events);
+    close(line[1]);
+    ioClose(dev);
+
+    return check_done("events");
+}
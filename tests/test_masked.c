@@ -0,0 +1,62 @@
+// Masked writes: pins change together, from the host copy of the latch,
+// writing only the ports that have pins in the mask
+
+#include "check.h"
+
+int main()
+{
+    struct i2cPerfDevice perf;
+
+    check_setup();
+    CHECK(ioSetWordDirection(0x0000) == 0);
+    CHECK(ioWriteWord(0x00F0) == 0);
+
+    // One port in the mask: one byte written, nothing read
+    i2cPerfReset();
+    CHECK(ioWritePinsMasked(0x000F, 0x0005) == 0);
+    CHECK(i2cSimGetOutputs(0x20) == 0x00F5);
+    perf = check_counters(0x20);
+    CHECK(perf.reads == 0);
+    CHECK(perf.writes == 1);
+    CHECK(perf.bytesWritten == 1);
+
+    // Both ports: one burst
+    i2cPerfReset();
+    CHECK(ioWritePinsMasked(0x0180, 0x0100) == 0);
+    CHECK(i2cSimGetOutputs(0x20) == 0x0175);
+    perf = check_counters(0x20);
+    CHECK(perf.reads == 0);
+    CHECK(perf.writes == 1);
+    CHECK(perf.bytesWritten == 2);
+
+    // Set, clear and toggle leave the other pins alone
+    CHECK(ioSetPins(0x8001) == 0);
+    CHECK(i2cSimGetOutputs(0x20) == 0x8175);
+    CHECK(ioClearPins(0x0070) == 0);
+    CHECK(i2cSimGetOutputs(0x20) == 0x8105);
+    CHECK(ioTogglePins(0xFF00) == 0);
+    CHECK(i2cSimGetOutputs(0x20) == 0x7E05);
+
+    // An empty mask writes nothing
+    i2cPerfReset();
+    CHECK(ioWritePinsMasked(0, 0xFFFF) == 0);
+    CHECK(ioTogglePins(0) == 0);
+    CHECK(check_counters(0x20).writes == 0);
+
+    // Direction and pull-ups only change the masked pins
+    CHECK(ioSetDirectionMasked(0xF000, 0xA000) == 0);
+    CHECK(check_word(0x20, SIM_IODIRA) == 0xA000);
+    CHECK(ioSetPullupsMasked(0x00FF, 0xFF0F) == 0);
+    CHECK(check_word(0x20, SIM_GPPUA) == 0x000F);
+
+    // If the current value can't be read nothing is written
+    ioInvalidateCache();
+    i2cSimFail(0x20, 1, -EIO);
+    CHECK(ioSetDirectionMasked(0x000F, 0x000F) == -EIO);
+    CHECK(check_word(0x20, SIM_IODIRA) == 0xA000);
+    CHECK(ioGetError() == -EIO);
+    CHECK(ioSetDirectionMasked(0x000F, 0x000F) == 0);
+    CHECK(check_word(0x20, SIM_IODIRA) == 0xA00F);
+
+    return check_done("masked");
+}
@@ -0,0 +1,100 @@
+// Pattern output: long streams are split into writes the bus takes, with
+// the register address in the same message, and 16 bit writes end on OLATB
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "check.h"
+
+// Pattern registers: OLATA with BANK=1 for 8 bit, BANK=0 for 16 bit
+#define BANK1_OLATA 0x0A
+
+#define VALUES 10000
+
+static char traceName[] = "/tmp/test_pattern.XXXXXX";
+static uint64_t traced;
+
+// Lengths of the writes to reg since the last call, from the trace.  Each
+// must also have succeeded.
+static int pattern_writes(uint8_t reg, int *lengths, int max)
+{
+    struct i2cTraceHeader header;
+    struct i2cTraceEvent event;
+    uint64_t c;
+    FILE *file;
+    int count;
+
+    count = 0;
+    CHECK(i2cTraceDump(traceName, I2C_TRACE_BINARY) == 0);
+    file = fopen(traceName, "rb");
+    CHECK(fread(&header, sizeof(header), 1, file) == 1);
+    for(c = 0; c < header.count && fread(&event, sizeof(event), 1, file) == 1; c++)
+    {
+        if(c >= traced && event.write && event.address == 0x20 && event.reg == reg)
+        {
+            CHECK(event.result == 0);
+            if(count < max)
+            {
+                lengths[count] = event.length;
+            }
+            count++;
+        }
+    }
+    fclose(file);
+    traced = header.count;
+
+    return count;
+}
+
+int main()
+{
+    static uint8_t bytes[VALUES];
+    static uint16_t words[VALUES];
+    uint16_t loop[3] = { 0x1111, 0x2222, 0x3333 };
+    ioPattern *pat;
+    int lengths[4];
+    int c;
+
+    check_setup();
+    close(mkstemp(traceName));
+    CHECK(ioSetWordDirection(0x0000) == 0);
+    for(c = 0; c < VALUES; c++)
+    {
+        bytes[c] = c;
+        words[c] = c * 3;
+    }
+    i2cTraceEnable(0);
+
+    // 8 bit: 8191 data bytes and the register address fill a message
+    pat = ioPatternOpen(ioDefaultDevice(), 8, IO_PORTA);
+    CHECK(pat != NULL);
+    pattern_writes(BANK1_OLATA, lengths, 4);
+    CHECK(ioPatternWrite(pat, bytes, VALUES) == VALUES);
+    CHECK(pattern_writes(BANK1_OLATA, lengths, 4) == 2);
+    CHECK(lengths[0] == 8191 && lengths[1] == VALUES - 8191);
+    CHECK(ioPatternWrite(pat, bytes, 8192) == 8192);
+    CHECK(pattern_writes(BANK1_OLATA, lengths, 4) == 2);
+    CHECK(lengths[0] == 8191 && lengths[1] == 1);
+    ioPatternClose(pat);
+    CHECK(i2cSimGetOutputs(0x20) == bytes[8191]);
+
+    // 16 bit: an even 8190, so each write leaves the pointer on OLATA
+    pat = ioPatternOpen(ioDefaultDevice(), 16, IO_PORTA);
+    CHECK(pat != NULL);
+    CHECK(ioPatternWrite(pat, words, VALUES / 2) == VALUES / 2);
+    CHECK(pattern_writes(SIM_OLATA, lengths, 4) == 2);
+    CHECK(lengths[0] == 8190 && lengths[1] == VALUES - 8190);
+    CHECK(i2cSimGetOutputs(0x20) == words[VALUES / 2 - 1]);
+
+    // Loops pack whole copies of the pattern into each write
+    CHECK(ioPatternLoop(pat, loop, 3, 2000) == 3 * 2000);
+    CHECK(pattern_writes(SIM_OLATA, lengths, 4) == 2);
+    CHECK(lengths[0] == 1365 * 6 && lengths[1] == (2000 - 1365) * 6);
+    CHECK(i2cSimGetOutputs(0x20) == 0x3333);
+    ioPatternClose(pat);
+
+    i2cTraceDisable();
+    unlink(traceName);
+
+    return check_done("pattern");
+}
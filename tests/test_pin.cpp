@@ -0,0 +1,61 @@
+// C++ pin maps: group writes and read-modify-writes that fail cleanly
+
+#include "edgpio.hpp"
+#include "check.h"
+
+typedef edgpio::Pin<IO_PORTA, 0> Led;
+typedef edgpio::PinGroup<edgpio::Pin<IO_PORTA, 4>, edgpio::Pin<IO_PORTB, 2>> Relays;
+typedef edgpio::PinGroup<edgpio::Pin<IO_PORTB, 6>, edgpio::Pin<IO_PORTB, 7>> Buttons;
+
+int main()
+{
+    ioDevice *dev;
+
+    check_setup();
+    dev = ioDefaultDevice();
+
+    // Direction and pull-ups change only the group's pins
+    CHECK(Relays::output(dev) == 0);
+    CHECK(Led::output(dev) == 0);
+    CHECK(ioGetWordDirection() == 0xFBEE);
+    CHECK(Buttons::pullup(dev, true) == 0);
+    CHECK(ioGetWordPullups() == 0xC000);
+
+    // Writes go to the latch together
+    CHECK(Relays::write(dev, true, true) == 0);
+    CHECK(i2cSimGetOutputs(0x20) == 0x0410);
+    CHECK(Led::set(dev) == 0);
+    CHECK(Relays::write(dev, false, true) == 0);
+    CHECK(i2cSimGetOutputs(0x20) == 0x0401);
+    CHECK(Relays::latch(dev) == 0x0400);
+
+    i2cSimSetInputs(0x20, 0x8000);
+    CHECK(Buttons::read(dev) == 0x8000);
+
+    // If the current directions can't be read nothing is written, rather
+    // than a 0 read turning the rest of the port into outputs
+    ioDevInvalidateCache(dev);
+    i2cSimFail(0x20, 1, -EIO);
+    CHECK(Buttons::output(dev) == -EIO);
+    CHECK(i2cSimGetRegister(0x20, SIM_IODIRA) == 0xEE);
+    CHECK(i2cSimGetRegister(0x20, SIM_IODIRB) == 0xFB);
+    CHECK(ioDevGetError(dev) == -EIO);
+
+    ioDevInvalidateCache(dev);
+    i2cSimFail(0x20, 1, -EIO);
+    CHECK(Relays::pullup(dev, true) == -EIO);
+    CHECK(i2cSimGetRegister(0x20, SIM_GPPUA) == 0x00);
+    CHECK(i2cSimGetRegister(0x20, SIM_GPPUB) == 0xC0);
+
+    ioDevInvalidateCache(dev);
+    i2cSimFail(0x20, 1, -EIO);
+    CHECK(Relays::set(dev) == -EIO);
+    CHECK(i2cSimGetOutputs(0x20) == 0x0401);
+    ioDevGetError(dev);
+
+    // And works again once the bus does
+    CHECK(Buttons::output(dev) == 0);
+    CHECK(ioGetWordDirection() == 0x3BEE);
+
+    return check_done("pin");
+}
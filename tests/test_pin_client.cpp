@@ -0,0 +1,39 @@
+// C++ pin maps through libedgpioclient.a, against an edgpiod on the
+// simulator started by "make test"
+
+#include "edgpio.hpp"
+#include "check.h"
+
+typedef edgpio::Pin<IO_PORTA, 0> Led;
+typedef edgpio::PinGroup<edgpio::Pin<IO_PORTA, 4>, edgpio::Pin<IO_PORTB, 2>> Relays;
+typedef edgpio::PinGroup<edgpio::Pin<IO_PORTB, 6>, edgpio::Pin<IO_PORTB, 7>> Buttons;
+
+int main()
+{
+    ioDevice *dev;
+
+    CHECK(ioInit(1, 0) == 0);
+    dev = ioDefaultDevice();
+
+    // Direction and pull-ups change only the group's pins
+    CHECK(Relays::output(dev) == 0);
+    CHECK(Led::output(dev) == 0);
+    CHECK(ioGetWordDirection() == 0xFBEE);
+    CHECK(Buttons::pullup(dev, true) == 0);
+    CHECK(ioGetWordPullups() == 0xC000);
+    CHECK(Relays::input(dev) == 0);
+    CHECK(ioGetWordDirection() == 0xFFFE);
+    CHECK(Buttons::pullup(dev, false) == 0);
+    CHECK(ioGetWordPullups() == 0x0000);
+
+    // Writes go to the latch together
+    CHECK(Relays::output(dev) == 0);
+    CHECK(Relays::write(dev, true, true) == 0);
+    CHECK(Relays::latch(dev) == 0x0410);
+    CHECK(Led::set(dev) == 0);
+    CHECK(Relays::write(dev, false, true) == 0);
+    CHECK(ioReadOutputLatch(IO_PORTA) == 0x01);
+    CHECK(ioReadOutputLatch(IO_PORTB) == 0x04);
+
+    return check_done("pin client");
+}
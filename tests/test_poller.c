@@ -0,0 +1,69 @@
+// Input poller: device reads served from the sample while pollers are
+// attached and closed under threads that keep reading
+
+#include <pthread.h>
+
+#include "check.h"
+
+#define READERS 4
+
+static ioDevice *dev;
+static int stop;
+static int wrong[READERS];
+
+static void *reader(void *arg)
+{
+    int *bad;
+
+    bad = arg;
+    while(__atomic_load_n(&stop, __ATOMIC_RELAXED) == 0)
+    {
+        if(ioDevReadWord(dev) != 0xA55A)
+        {
+            (*bad)++;
+        }
+    }
+
+    return NULL;
+}
+
+int main()
+{
+    struct ioInputSnapshot snapshot;
+    pthread_t threads[READERS];
+    ioPoller *poller;
+    int c;
+
+    check_setup();
+    dev = ioDefaultDevice();
+    i2cSimSetInputs(0x20, 0xA55A);
+
+    // Reads come from the sample, not the bus
+    poller = ioPollerOpen(dev, 1000, 0);
+    CHECK(poller != NULL);
+    CHECK(ioPollerRead(poller, &snapshot) == 0);
+    CHECK(snapshot.gpio == 0xA55A);
+    CHECK(ioDevReadWord(dev) == 0xA55A);
+    CHECK(ioDevReadPort(dev, IO_PORTB) == 0xA5);
+    ioPollerClose(poller);
+
+    // Attach and close while other threads read through the device
+    for(c = 0; c < READERS; c++)
+    {
+        CHECK(pthread_create(&threads[c], NULL, reader, &wrong[c]) == 0);
+    }
+    for(c = 0; c < 200; c++)
+    {
+        poller = ioPollerOpen(dev, 100, 0);
+        CHECK(poller != NULL);
+        ioPollerClose(poller);
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for(c = 0; c < READERS; c++)
+    {
+        pthread_join(threads[c], NULL);
+        CHECK(wrong[c] == 0);
+    }
+
+    return check_done("poller");
+}
@@ -0,0 +1,130 @@
+// Pin event ring: capacity and overflow, device logging of GPIO reads and
+// interrupt captures, and several producers against one consumer
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "check.h"
+
+#define PRODUCERS 4
+#define PUSHES    20000
+
+static ioRing *shared;
+
+// Pushes events numbered from 1 in timestamp, retrying while the ring is full
+static void *producer(void *arg)
+{
+    struct ioPinEvent event;
+
+    event.dev = NULL;
+    event.port = IO_PORTA;
+    event.value = (uint8_t)(intptr_t)arg;
+    event.changed = 0;
+    for(event.timestamp = 1; event.timestamp <= PUSHES; event.timestamp++)
+    {
+        while(ioRingPush(shared, &event) < 0)
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+int main()
+{
+    struct ioPinEvent events[8];
+    pthread_t threads[PRODUCERS];
+    uint64_t last[PRODUCERS];
+    uint16_t flags;
+    uint16_t capture;
+    ioRing *ring;
+    int received;
+    int ordered;
+    int count;
+    int c;
+
+    check_setup();
+
+    // Capacity rounds up to 4, the fifth push is dropped and counted
+    ring = ioRingOpen(3);
+    for(c = 0; c < 5; c++)
+    {
+        CHECK(ioRingRecord(ring, NULL, IO_PORTA, c, 0) == (c < 4 ? 0 : -1));
+    }
+    CHECK(ioRingOverflows(ring) == 1);
+    CHECK(ioRingDrain(ring, events, 3) == 3);
+    CHECK(events[0].value == 0 && events[2].value == 2);
+    CHECK(events[0].timestamp <= events[2].timestamp);
+    CHECK(ioRingDrain(ring, events, 8) == 1);
+    CHECK(events[0].value == 3);
+    CHECK(ioRingDrain(ring, events, 8) == 0);
+
+    // Keeps working as the positions wrap round the slots
+    for(c = 0; c < 10; c++)
+    {
+        CHECK(ioRingRecord(ring, NULL, IO_PORTB, c, 0) == 0);
+        CHECK(ioRingRecord(ring, NULL, IO_PORTB, c + 1, 0) == 0);
+        CHECK(ioRingDrain(ring, events, 8) == 2);
+        CHECK(events[0].value == c && events[1].value == c + 1);
+    }
+
+    // A device logs its first read of a port and then only changes
+    ioSetRing(ring);
+    i2cSimSetInputs(0x20, 0x0011);
+    ioReadPort(IO_PORTA);
+    ioReadPort(IO_PORTA);
+    i2cSimSetInputs(0x20, 0x0013);
+    ioReadPort(IO_PORTA);
+    CHECK(ioRingDrain(ring, events, 8) == 2);
+    CHECK(events[0].dev == ioDefaultDevice());
+    CHECK(events[0].port == IO_PORTA && events[0].value == 0x11);
+    CHECK(events[1].value == 0x13 && events[1].changed == 0x02);
+
+    // Interrupt captures are logged with the pins that fired
+    CHECK(ioSetInterruptOnWord(0x0100) == 0);
+    i2cSimSetInputs(0x20, 0x0113);
+    CHECK(ioRingDrain(ring, events, 8) == 0);
+    CHECK(ioReadInterrupts(&flags, &capture) == 0);
+    CHECK(flags == 0x0100);
+    CHECK(ioRingDrain(ring, events, 8) == 1);
+    CHECK(events[0].port == IO_PORTB && events[0].value == 0x01 && events[0].changed == 0x01);
+    ioSetRing(NULL);
+    ioRingClose(ring);
+
+    // Every event arrives once, in order per producer
+    shared = ioRingOpen(64);
+    for(c = 0; c < PRODUCERS; c++)
+    {
+        last[c] = 0;
+        CHECK(pthread_create(&threads[c], NULL, producer, (void *)(intptr_t)c) == 0);
+    }
+    received = 0;
+    ordered = 1;
+    while(received < PRODUCERS * PUSHES)
+    {
+        count = ioRingDrain(shared, events, 8);
+        if(count == 0)
+        {
+            sched_yield();
+        }
+        for(c = 0; c < count; c++)
+        {
+            if(events[c].timestamp != last[events[c].value] + 1)
+            {
+                ordered = 0;
+            }
+            last[events[c].value] = events[c].timestamp;
+        }
+        received += count;
+    }
+    for(c = 0; c < PRODUCERS; c++)
+    {
+        pthread_join(threads[c], NULL);
+    }
+    CHECK(ordered);
+    CHECK(ioRingDrain(shared, events, 8) == 0);
+    ioRingClose(shared);
+
+    return check_done("ring");
+}
@@ -0,0 +1,37 @@
+// Cached RTC time: the first sync waits for a seconds rollover without
+// hammering the bus and lines the anchor up with it
+
+#include <time.h>
+
+#include "check.h"
+
+int main()
+{
+    struct timespec now;
+    struct timespec real;
+    int64_t error;
+
+    check_setup();
+
+    // The simulated DS1307 runs from the system clock, rolling over on its
+    // second boundaries
+    i2cPerfReset();
+    rtcSetCaching(60);
+    CHECK(rtcNow(&now) == 0);
+    clock_gettime(CLOCK_REALTIME, &real);
+
+    // Polled every 10 ms for at most 1.1 s, not thousands of reads
+    CHECK(check_counters(SIM_RTCADDRESS).reads >= 1);
+    CHECK(check_counters(SIM_RTCADDRESS).reads <= 120);
+
+    error = (real.tv_sec - now.tv_sec) * 1000000000LL + real.tv_nsec - now.tv_nsec;
+    CHECK(error > -20000000 && error < 20000000);
+
+    // Served from the anchor until the next resync
+    CHECK(rtcNow(&now) == 0);
+    CHECK(check_counters(SIM_RTCADDRESS).reads <= 120);
+
+    rtcSetCaching(0);
+
+    return check_done("rtc");
+}
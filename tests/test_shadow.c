@@ -0,0 +1,83 @@
+// Register cache and batched writes: the reset burst, getters served from
+// the host copy, and ioDevBegin()/ioDevCommit() bursts
+
+#include "check.h"
+
+int main()
+{
+    struct i2cPerfDevice perf;
+    ioDevice *dev;
+
+    check_setup();
+
+    // Leave the chip configured with an interrupt pending
+    dev = ioOpen(checkBus, 0x22, 0);
+    CHECK(dev != NULL);
+    CHECK(ioDevSetWordDirection(dev, 0x00F0) == 0);
+    CHECK(ioDevSetWordPullups(dev, 0x1234) == 0);
+    CHECK(ioDevWriteWord(dev, 0xFF0F) == 0);
+    CHECK(ioDevSetInterruptOnWord(dev, 0x00F0) == 0);
+    i2cSimSetInputs(0x22, 0x0010);
+    CHECK(check_word(0x22, SIM_INTFA) == 0x0010);
+    ioClose(dev);
+
+    // Reset is IOCON, one burst of the rest and one interrupt read
+    i2cPerfReset();
+    dev = ioOpen(checkBus, 0x22, 1);
+    CHECK(dev != NULL);
+    perf = check_counters(0x22);
+    CHECK(perf.reads + perf.writes == 3);
+    CHECK(check_word(0x22, SIM_IODIRA) == 0xFFFF);
+    CHECK(check_word(0x22, SIM_GPINTENA) == 0);
+    CHECK(check_word(0x22, SIM_IOCON) == 0x0202);
+    CHECK(check_word(0x22, SIM_GPPUA) == 0);
+    CHECK(check_word(0x22, SIM_INTFA) == 0);
+    CHECK(check_word(0x22, SIM_OLATA) == 0);
+
+    // Configuration getters never touch the bus
+    i2cPerfReset();
+    CHECK(ioDevGetWordDirection(dev) == 0xFFFF);
+    CHECK(ioDevGetWordPullups(dev) == 0);
+    perf = check_counters(0x22);
+    CHECK(perf.reads + perf.writes == 0);
+
+    // A batch is held back until the commit, then sent as one burst for
+    // 0x00 - 0x0D and one for OLAT
+    ioDevBegin(dev);
+    CHECK(ioDevSetWordDirection(dev, 0x00FF) == 0);
+    CHECK(ioDevSetWordPullups(dev, 0xFF00) == 0);
+    CHECK(ioDevWriteWord(dev, 0x5A00) == 0);
+    perf = check_counters(0x22);
+    CHECK(perf.reads + perf.writes == 0);
+    CHECK(check_word(0x22, SIM_IODIRA) == 0xFFFF);
+    CHECK(ioDevCommit(dev) == 0);
+    CHECK(check_counters(0x22).writes == 2);
+    CHECK(check_word(0x22, SIM_IODIRA) == 0x00FF);
+    CHECK(check_word(0x22, SIM_GPPUA) == 0xFF00);
+    CHECK(i2cSimGetOutputs(0x22) == 0x5A00);
+
+    // Batches nest, only the outer commit sends
+    i2cPerfReset();
+    ioDevBegin(dev);
+    ioDevBegin(dev);
+    CHECK(ioDevSetWordPullups(dev, 0x0001) == 0);
+    CHECK(ioDevCommit(dev) == 0);
+    perf = check_counters(0x22);
+    CHECK(perf.reads + perf.writes == 0);
+    CHECK(ioDevCommit(dev) == 0);
+    CHECK(check_counters(0x22).writes == 1);
+    CHECK(check_word(0x22, SIM_GPPUA) == 0x0001);
+
+    // A failed commit drops the batch and the cache is reloaded from the chip
+    ioDevBegin(dev);
+    CHECK(ioDevSetWordDirection(dev, 0x0F0F) == 0);
+    i2cSimFail(0x22, 1, -EIO);
+    CHECK(ioDevCommit(dev) == -EIO);
+    CHECK(ioDevGetError(dev) == -EIO);
+    CHECK(ioDevGetWordDirection(dev) == 0x00FF);
+    CHECK(check_word(0x22, SIM_IODIRA) == 0x00FF);
+
+    ioClose(dev);
+
+    return check_done("shadow");
+}
@@ -0,0 +1,51 @@
+// Simulator model: register access, byte mode, fault injection
+
+#include "check.h"
+
+int main()
+{
+    ioDevice *dev;
+    int c;
+
+    check_setup();
+
+    // Power on state after ioInit(1): all inputs, IOCON sequential mode
+    CHECK(i2cSimGetRegister(0x20, SIM_IODIRA) == 0xFF);
+    CHECK(i2cSimGetRegister(0x20, SIM_IODIRB) == 0xFF);
+    CHECK(i2cSimGetRegister(0x20, 0x16) == -1);
+    CHECK(i2cSimGetRegister(0x50, 0x00) == -1);
+
+    // Writes land in OLAT and drive output pins
+    CHECK(ioSetWordDirection(0xFF00) == 0);
+    CHECK(ioWritePort(IO_PORTA, 0x5A) == 0);
+    CHECK(i2cSimGetRegister(0x20, SIM_OLATA) == 0x5A);
+    CHECK(i2cSimGetOutputs(0x20) == 0x005A);
+
+    // Inputs read through GPIO
+    i2cSimSetInputs(0x20, 0xA500);
+    CHECK(ioReadPort(IO_PORTB) == 0xA5);
+
+    // Failures are counted per transaction and reported through ioGetError()
+    ioGetError();
+    i2cSimFail(0x20, 1, -EIO);
+    CHECK(ioReadPort(IO_PORTB) == 0);
+    CHECK(ioGetError() == -EIO);
+    CHECK(ioReadPort(IO_PORTB) == 0xA5);
+    CHECK(ioGetError() == 0);
+
+    // Only the chip asked for fails
+    i2cSimFail(0x21, 1, -EIO);
+    CHECK(ioReadPort(IO_PORTB) == 0xA5);
+    CHECK(ioOpen(I2C_SIM_BUS, 0x21, 1) == NULL);
+    dev = ioOpen(I2C_SIM_BUS, 0x21, 1);
+    CHECK(dev != NULL);
+    ioClose(dev);
+
+    // The DS1307 RAM powers up clear
+    for(c = RTCMEMSTART; c < RTCMEMSIZE; c++)
+    {
+        CHECK(i2cSimGetRegister(SIM_RTCADDRESS, c) == 0);
+    }
+
+    return check_done("sim");
+}
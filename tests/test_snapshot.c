@@ -0,0 +1,107 @@
+// Register snapshots: one burst to read them all, diffs, and applying a
+// saved state back in as few writes as possible
+
+#include <string.h>
+
+#include "check.h"
+
+// INTF, INTCAP and GPIO follow the pins, ioApply() doesn't write them
+#define READ_ONLY ((1 << SIM_INTFA) | (1 << SIM_INTFB) | (1 << SIM_INTCAPA) | \
+                   (1 << SIM_INTCAPB) | (1 << SIM_GPIOA) | (1 << SIM_GPIOB))
+
+int main()
+{
+    struct ioRegisterSnapshot saved;
+    struct ioRegisterSnapshot current;
+    struct ioRegisterSnapshot changed;
+    struct i2cPerfDevice perf;
+    int reg;
+    int same;
+
+    check_setup();
+    CHECK(ioSetWordDirection(0x00FF) == 0);
+    CHECK(ioSetWordPullups(0x0F00) == 0);
+    CHECK(ioWriteWord(0xAA00) == 0);
+    CHECK(ioSetInterruptOnWord(0x0003) == 0);
+    i2cSimSetInputs(0x20, 0x0001);
+    CHECK(i2cSimGetRegister(0x20, SIM_INTFA) == 0x01);
+
+    // Every register in one read, which acknowledges the interrupt
+    i2cPerfReset();
+    CHECK(ioSnapshot(&saved) == 0);
+    perf = check_counters(0x20);
+    CHECK(perf.reads == 1);
+    CHECK(perf.writes == 0);
+    CHECK(saved.regs[SIM_INTFA] == 0x01);
+    CHECK(saved.regs[SIM_INTCAPA] == 0x01);
+    CHECK(i2cSimGetRegister(0x20, SIM_INTFA) == 0);
+    same = 1;
+    for(reg = 0; reg < IO_REGISTERS; reg++)
+    {
+        if(reg != SIM_INTFA && saved.regs[reg] != i2cSimGetRegister(0x20, reg))
+        {
+            same = 0;
+        }
+    }
+    CHECK(same);
+
+    // Diffs are a bit per register
+    CHECK(ioDiff(&saved, &saved) == 0);
+    memcpy(&changed, &saved, sizeof(changed));
+    changed.regs[SIM_IODIRA] ^= 0x01;
+    changed.regs[SIM_OLATB] ^= 0x80;
+    CHECK(ioDiff(&saved, &changed) == ((1u << SIM_IODIRA) | (1u << SIM_OLATB)));
+
+    // Restoring IODIRB and GPPUB is one burst across the known registers
+    CHECK(ioSetWordDirection(0xFFFF) == 0);
+    CHECK(ioSetWordPullups(0x0000) == 0);
+    CHECK(ioSnapshot(&current) == 0);
+    CHECK((ioDiff(&current, &saved) & ~READ_ONLY) == ((1u << SIM_IODIRB) | (1u << SIM_GPPUB)));
+    i2cPerfReset();
+    CHECK(ioApply(&current, &saved) == 0);
+    perf = check_counters(0x20);
+    CHECK(perf.reads == 0);
+    CHECK(perf.writes == 1);
+    CHECK(ioSnapshot(&current) == 0);
+    CHECK((ioDiff(&current, &saved) & ~READ_ONLY) == 0);
+    CHECK(ioGetWordDirection() == 0x00FF);
+
+    // Registers apart, one burst each
+    i2cPerfReset();
+    CHECK(ioApply(&current, &changed) == 0);
+    CHECK(check_counters(0x20).writes == 2);
+    CHECK(i2cSimGetOutputs(0x20) == 0x2A00);
+
+    // Nothing to do, nothing sent
+    i2cPerfReset();
+    CHECK(ioApply(&changed, &changed) == 0);
+    CHECK(check_counters(0x20).writes == 0);
+
+    // Bank mode would move every register, it is refused
+    memcpy(&changed, &saved, sizeof(changed));
+    changed.regs[SIM_IOCON] |= 0x80;
+    CHECK(ioApply(&saved, &changed) == -1);
+    CHECK(check_counters(0x20).writes == 0);
+    CHECK(i2cSimGetRegister(0x20, SIM_IOCON) == saved.regs[SIM_IOCON]);
+
+    // So is byte mode, a burst through IOCON would stop stepping there and
+    // write the rest over it
+    memcpy(&changed, &saved, sizeof(changed));
+    changed.regs[SIM_IOCON] |= 0x20;
+    changed.regs[SIM_IOCONB] |= 0x20;
+    changed.regs[SIM_IODIRA] ^= 0x01;
+    changed.regs[SIM_GPPUB] ^= 0x01;
+    changed.regs[SIM_OLATB] ^= 0x01;
+    CHECK(ioApply(&saved, &changed) == -1);
+    CHECK(ioApply(&changed, &saved) == -1);
+    CHECK(check_counters(0x20).writes == 0);
+    CHECK(i2cSimGetRegister(0x20, SIM_IOCON) == saved.regs[SIM_IOCON]);
+    CHECK(i2cSimGetRegister(0x20, SIM_GPPUB) == saved.regs[SIM_GPPUB]);
+
+    // A failed read is reported
+    i2cSimFail(0x20, 1, -EIO);
+    CHECK(ioSnapshot(&current) == -EIO);
+    CHECK(ioGetError() == -EIO);
+
+    return check_done("snapshot");
+}